@@ -0,0 +1,64 @@
+#!/bin/sh
+# This script replays synthetic editing sessions headless and reports
+# the time, the number of frames and the bytes written for each.
+
+unset EXINIT HOME
+export LINES=25 COLUMNS=80
+dir=/tmp/.neatvi_bench
+mkdir -p $dir
+
+# chunk keys: one input block, as read from the terminal
+chunk() {
+	printf "0 %d\n" $(printf "$1" | wc -c)
+	printf "$1"
+}
+
+# repeat keys count
+repeat() {
+	i=0
+	while [ $i -lt $2 ]; do
+		chunk "$1"
+		i=$((i + 1))
+	done
+}
+
+# bench name file: replay $dir/name.log on file
+bench() {
+	cp $2 $dir/file
+	printf "%-8s " $1
+	./vi -p $dir/$1.log -v $dir/file 2>&1 >/dev/null | sed 's/^replay: //'
+}
+
+# spawn name file: the time of running :!true with file loaded
+spawn() {
+	cp $2 $dir/file
+	printf "%-8s " $1
+	{ i=0; while [ $i -lt 300 ]; do echo ":!true"; i=$((i + 1)); done; } > $dir/spawn.ex
+	echo ":q!" >> $dir/spawn.ex
+	t0=$(date +%s%N)
+	echo ":q!" | ./vi -s -e $dir/file >/dev/null
+	t1=$(date +%s%N)
+	./vi -s -e $dir/file <$dir/spawn.ex >/dev/null
+	t2=$(date +%s%N)
+	echo "$(( (t2 - t1 - (t1 - t0)) / 300000 ))us/command"
+}
+
+cat vi.c ex.c led.c > $dir/code.c
+awk 'BEGIN {for (i = 0; i < 20000; i++) printf("word%d ", i); printf("\n")}' > $dir/long.txt
+
+{ repeat "j" 1000; repeat "k" 1000; chunk ":q!\n"; } > $dir/scroll.log
+{ repeat "\006" 100; repeat "\002" 100; chunk ":q!\n"; } > $dir/page.log
+{ chunk "/static\n"; repeat "n" 300; chunk ":q!\n"; } > $dir/search.log
+{ chunk "500Go"; repeat "x" 1000; chunk "\033"; chunk ":q!\n"; } > $dir/insert.log
+{ chunk "10000|i"; repeat "x" 500; chunk "\033"; chunk ":q!\n"; } > $dir/longline.log
+
+bench scroll $dir/code.c
+bench page $dir/code.c
+bench search $dir/code.c
+bench insert $dir/code.c
+bench longline $dir/long.txt
+
+awk 'BEGIN {for (i = 0; i < 2000000; i++) printf("line %d of a large buffer\n", i)}' > $dir/large.txt
+spawn spawn1 $dir/code.c
+spawn spawn2 $dir/large.txt
+rm -r $dir
@@ -1,39 +1,52 @@
+#include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include "vi.h"
 
+extern char **environ;
+
+/* start argv[0] with the given pipes as its standard input and output;
+ * posix_spawn() avoids copying the page tables of a large editor */
 static int cmd_make(char **argv, int *ifd, int *ofd)
 {
-	int pid;
+	posix_spawn_file_actions_t fa;
 	int pipefds0[2];
 	int pipefds1[2];
-	if (ifd)
-		pipe(pipefds0);
-	if (ofd)
-		pipe(pipefds1);
-	if (!(pid = fork())) {
-		if (ifd) {		/* setting up stdin */
-			dup2(pipefds0[0], 0);
-			close(pipefds0[1]);
+	int pid;
+	if (ifd && pipe(pipefds0) < 0)
+		return -1;
+	if (ofd && pipe(pipefds1) < 0) {
+		if (ifd) {
 			close(pipefds0[0]);
+			close(pipefds0[1]);
 		}
-		if (ofd) {		/* setting up stdout and stderr */
-			dup2(pipefds1[1], 1);
-			dup2(pipefds1[1], 2);
-			close(pipefds1[0]);
-			close(pipefds1[1]);
-		}
-		execvp(argv[0], argv);
-		exit(1);
+		return -1;
+	}
+	posix_spawn_file_actions_init(&fa);
+	if (ifd) {		/* setting up stdin */
+		posix_spawn_file_actions_adddup2(&fa, pipefds0[0], 0);
+		posix_spawn_file_actions_addclose(&fa, pipefds0[0]);
+		posix_spawn_file_actions_addclose(&fa, pipefds0[1]);
+	}
+	if (ofd) {		/* setting up stdout and stderr */
+		posix_spawn_file_actions_adddup2(&fa, pipefds1[1], 1);
+		posix_spawn_file_actions_adddup2(&fa, pipefds1[1], 2);
+		posix_spawn_file_actions_addclose(&fa, pipefds1[0]);
+		posix_spawn_file_actions_addclose(&fa, pipefds1[1]);
 	}
+	if (posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ))
+		pid = -1;
+	posix_spawn_file_actions_destroy(&fa);
 	if (ifd)
 		close(pipefds0[0]);
 	if (ofd)
@@ -52,29 +65,89 @@ static int cmd_make(char **argv, int *ifd, int *ofd)
 	return pid;
 }
 
-/*
- * Execute a shell command.
- *
- * If ibuf is given, it is passed as standard input to the process.
- * Otherwise, the process reads from the terminal.
- *
- * If oproc is 0, the process writes directly to the terminal.  If it
- * is 1, process' output is saved and returned.  If it is 2, in addition
- * to returning the output, it is written to the terminal.
- */
-char *cmd_pipe(char *cmd, char *ibuf, int oproc)
+#define CMDBUF		(1 << 16)	/* the size of pipe buffers */
+#define CMDPROG		500		/* milliseconds between progress reports */
+#define CMDKILL		1000		/* milliseconds before killing an interrupted command */
+
+/* the standard input of a command: a string or buffer lines */
+struct cmdin {
+	char *s;		/* the remaining string */
+	long len;		/* its length */
+	struct lbuf *lb;	/* buffer lines */
+	int beg, end;		/* the remaining lines */
+	char buf[CMDBUF];	/* the block of lines being written */
+};
+
+static long cmd_msec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* the next block of input; lines are copied into blocks unless long */
+static long cmd_next(struct cmdin *in, char **blk)
+{
+	long n = 0;
+	if (!in->lb) {
+		*blk = in->s;
+		n = in->len;
+		in->s += n;
+		in->len = 0;
+		return n;
+	}
+	*blk = in->buf;
+	while (in->beg < in->end) {
+		char *ln = lbuf_get(in->lb, in->beg);
+		long len = strlen(ln);
+		if (!n && len >= sizeof(in->buf)) {
+			*blk = ln;
+			in->beg++;
+			return len;
+		}
+		if (n + len > sizeof(in->buf))
+			break;
+		memcpy(in->buf + n, ln, len);
+		n += len;
+		in->beg++;
+	}
+	return n;
+}
+
+/* wait for pid; an interrupted command that does not exit is killed */
+static void cmd_wait(int pid, int intr)
+{
+	long end = cmd_msec() + CMDKILL;
+	while (waitpid(pid, NULL, intr ? WNOHANG : 0) == 0) {
+		if (cmd_msec() >= end) {
+			kill(pid, SIGKILL);
+			intr = 0;
+		} else {
+			poll(NULL, 0, 20);
+		}
+	}
+}
+
+/* run cmd with the given input; returns NULL if interrupted with ^C */
+static char *cmd_run(char *cmd, struct cmdin *in, int oproc)
 {
 	char *argv[] = {"/bin/sh", "-c", cmd, NULL};
 	struct pollfd fds[3];
 	struct sbuf sb = {0};
-	char buf[512];
+	char *buf = malloc(CMDBUF);
+	char *blk = NULL;
+	long blen = 0, boff = 0;
+	long nw = 0;
+	long prog = cmd_msec() + CMDPROG;
 	int ifd = -1, ofd = -1;
-	int slen = ibuf != NULL ? strlen(ibuf) : 0;
-	int nw = 0;
-	int pid = cmd_make(argv, ibuf ? &ifd : NULL, oproc ? &ofd : NULL);
-	if (pid <= 0)
+	int intr = 0;
+	int pid = cmd_make(argv, in ? &ifd : NULL, oproc ? &ofd : NULL);
+	if (pid <= 0) {
+		free(buf);
 		return NULL;
-	if (!ibuf) {
+	}
+	PROF_BEG(PROF_CMD);
+	if (!in) {
 		signal(SIGINT, SIG_IGN);
 		term_done();
 	}
@@ -84,11 +157,11 @@ char *cmd_pipe(char *cmd, char *ibuf, int oproc)
 	fds[0].events = POLLIN;
 	fds[1].fd = ifd;
 	fds[1].events = POLLOUT;
-	fds[2].fd = isatty(0) && ibuf != NULL ? 0 : -1;
+	fds[2].fd = isatty(0) && in ? 0 : -1;
 	fds[2].events = POLLIN;
-	while ((fds[0].fd >= 0 || fds[1].fd >= 0) && poll(fds, 3, 200) >= 0) {
+	while ((fds[0].fd >= 0 || fds[1].fd >= 0) && ev_poll(fds, 3, 200) >= 0) {
 		if (fds[0].revents & POLLIN) {
-			int ret = read(fds[0].fd, buf, sizeof(buf));
+			int ret = read(fds[0].fd, buf, CMDBUF);
 			if (ret > 0 && oproc == 2)
 				write(1, buf, ret);
 			if (ret > 0)
@@ -102,10 +175,18 @@ char *cmd_pipe(char *cmd, char *ibuf, int oproc)
 			fds[0].fd = -1;
 		}
 		if (fds[1].revents & POLLOUT) {
-			int ret = write(fds[1].fd, ibuf + nw, slen - nw);
+			int ret = 0;
+			if (boff == blen) {
+				blen = cmd_next(in, &blk);
+				boff = 0;
+			}
+			if (boff < blen)
+				ret = write(fds[1].fd, blk + boff, blen - boff);
+			if (ret > 0)
+				boff += ret;
 			if (ret > 0)
 				nw += ret;
-			if (ret <= 0 || nw == slen) {
+			if (ret <= 0) {
 				close(fds[1].fd);
 				fds[1].fd = -1;
 			}
@@ -114,33 +195,206 @@ char *cmd_pipe(char *cmd, char *ibuf, int oproc)
 			fds[1].fd = -1;
 		}
 		if (fds[2].revents & POLLIN) {
-			int ret = read(fds[2].fd, buf, sizeof(buf));
+			int ret = read(fds[2].fd, buf, CMDBUF);
 			int i;
 			for (i = 0; i < ret; i++)
 				if ((unsigned char) buf[i] == TK_CTL('c'))
-					kill(pid, SIGINT);
+					intr = 1;
 		} else if (fds[2].revents & (POLLERR | POLLHUP | POLLNVAL)) {
 			fds[2].fd = -1;
 		}
+		if (intr) {
+			kill(pid, SIGINT);
+			break;
+		}
+		if (fds[2].fd >= 0 && cmd_msec() >= prog) {
+			ex_progress("!%s: %ld KB written, %ld KB read",
+				cmd, nw >> 10, sbuf_len(&sb) >> 10);
+			prog = cmd_msec() + CMDPROG;
+		}
 	}
-	close(fds[0].fd);
-	close(fds[1].fd);
-	waitpid(pid, NULL, 0);
-	if (ibuf == NULL) {
+	if (fds[0].fd >= 0)
+		close(fds[0].fd);
+	if (fds[1].fd >= 0)
+		close(fds[1].fd);
+	cmd_wait(pid, intr);
+	if (!in) {
 		term_init();
 		signal(SIGINT, SIG_DFL);
 	}
+	PROF_END(PROF_CMD, nw + sbuf_len(&sb));
+	free(buf);
+	if (intr) {
+		ex_show("!%s: interrupted", cmd);
+		sbuf_free(&sb);
+		return NULL;
+	}
 	if (oproc)
 		return sbuf_done(&sb);
+	sbuf_free(&sb);
 	return NULL;
 }
 
+/*
+ * Execute a shell command.
+ *
+ * If ibuf is given, it is passed as standard input to the process.
+ * Otherwise, the process reads from the terminal.
+ *
+ * If oproc is 0, the process writes directly to the terminal.  If it
+ * is 1, process' output is saved and returned.  If it is 2, in addition
+ * to returning the output, it is written to the terminal.
+ */
+char *cmd_pipe(char *cmd, char *ibuf, int oproc)
+{
+	struct cmdin *in = NULL;
+	char *out;
+	if (ibuf) {
+		in = malloc(sizeof(*in));
+		memset(in, 0, sizeof(*in));
+		in->s = ibuf;
+		in->len = strlen(ibuf);
+	}
+	out = cmd_run(cmd, in, oproc);
+	free(in);
+	return out;
+}
+
+/* pass lines [beg, end) of lb through cmd and return its output;
+ * returns NULL on failure or if interrupted */
+char *cmd_filter(char *cmd, struct lbuf *lb, int beg, int end)
+{
+	struct cmdin *in = malloc(sizeof(*in));
+	char *out;
+	memset(in, 0, sizeof(*in));
+	in->lb = lb;
+	in->beg = beg;
+	in->end = end;
+	out = cmd_run(cmd, in, 1);
+	free(in);
+	return out;
+}
+
 int cmd_exec(char *cmd)
 {
 	cmd_pipe(cmd, NULL, 0);
 	return 0;
 }
 
+/* a background job, whose output is appended to the quick fix register */
+static int job_pid;		/* the running job; zero if none */
+static char job_name[64];	/* the command of the last job */
+static struct sbuf job_ln;	/* the incomplete last line of output */
+static long job_lines;		/* the number of lines read */
+static int job_exit = -1;	/* the exit status of the last job */
+static long job_shown;		/* when the state was last shown */
+
+static void job_show(void)
+{
+	ex_notify("%s", cmd_jobstate());
+	job_shown = cmd_msec();
+}
+
+static void job_reap(void *dat)
+{
+	int status;
+	int ret = waitpid(job_pid, &status, WNOHANG);
+	if (ret == 0) {
+		ev_timer(100, job_reap, NULL);
+		return;
+	}
+	job_exit = ret > 0 && WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+	job_pid = 0;
+	job_show();
+}
+
+/* append the complete lines of the output to the * register */
+static void job_recv(int fd, int revents, void *dat)
+{
+	char buf[CMDBUF / 4];
+	char *s;
+	long eol = 0, i;
+	int ret = read(fd, buf, sizeof(buf));
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (ret > 0)
+		sbuf_mem(&job_ln, buf, ret);
+	if (ret <= 0 && sbuf_len(&job_ln) && sbuf_buf(&job_ln)[sbuf_len(&job_ln) - 1] != '\n')
+		sbuf_chr(&job_ln, '\n');
+	s = sbuf_buf(&job_ln);
+	for (i = 0; i < sbuf_len(&job_ln); i++) {
+		if (s[i] == '\n') {
+			eol = i + 1;
+			job_lines++;
+		}
+	}
+	if (eol) {
+		char c = s[eol];
+		s[eol] = '\0';
+		reg_append('*', s);
+		s[eol] = c;
+		memmove(s, s + eol, sbuf_len(&job_ln) - eol);
+		sbuf_cut(&job_ln, sbuf_len(&job_ln) - eol);
+	}
+	if (ret <= 0) {
+		ev_del(fd);
+		close(fd);
+		sbuf_free(&job_ln);
+		job_reap(NULL);
+	} else if (cmd_msec() - job_shown >= 1000) {
+		job_show();
+	}
+}
+
+/* start cmd in the background; its output replaces the * register */
+int cmd_job(char *cmd)
+{
+	char *argv[] = {"/bin/sh", "-c", cmd, NULL};
+	int ifd, ofd;
+	int pid;
+	if (job_pid)
+		return 1;
+	if ((pid = cmd_make(argv, &ifd, &ofd)) <= 0)
+		return 1;
+	close(ifd);
+	fcntl(ofd, F_SETFL, fcntl(ofd, F_GETFL, 0) | O_NONBLOCK);
+	fcntl(ofd, F_SETFD, fcntl(ofd, F_GETFD, 0) | FD_CLOEXEC);
+	if (ev_add(ofd, POLLIN, job_recv, NULL)) {
+		close(ofd);
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return 1;
+	}
+	job_pid = pid;
+	job_lines = 0;
+	job_exit = -1;
+	job_shown = cmd_msec();
+	snprintf(job_name, sizeof(job_name), "%s", cmd);
+	reg_put('*', "", 1);
+	qfix_reset();
+	return 0;
+}
+
+/* the state of the last background job or NULL */
+char *cmd_jobstate(void)
+{
+	static char state[128];
+	if (!job_name[0])
+		return NULL;
+	if (job_pid)
+		snprintf(state, sizeof(state), "%s: running, %ld lines", job_name, job_lines);
+	else
+		snprintf(state, sizeof(state), "%s: exit %d, %ld lines", job_name, job_exit, job_lines);
+	return state;
+}
+
+/* terminate the running job */
+void cmd_jobkill(void)
+{
+	if (job_pid)
+		kill(job_pid, SIGTERM);
+}
+
 char *cmd_unix(char *path, char *ibuf)
 {
 	char buf[512];
@@ -7,30 +7,42 @@ static struct rset *dir_rslr;	/* pattern of marks for left-to-right strings */
 static struct rset *dir_rsrl;	/* pattern of marks for right-to-left strings */
 static struct rset *dir_rsctx;	/* direction context patterns */
 
+/* the index of the character at offset o of the line */
+static int dir_idx(char **chrs, int beg, int end, int o)
+{
+	char *s = chrs[0] + o;
+	while (beg < end) {
+		int m = (beg + end) / 2;
+		if (chrs[m] < s)
+			beg = m + 1;
+		else
+			end = m;
+	}
+	return beg;
+}
+
 static int dir_match(char **chrs, int beg, int end, int ctx, int *rec,
 		int *r_beg, int *r_end, int *c_beg, int *c_end, int *dir)
 {
 	int subs[16 * 2];
 	struct rset *rs = ctx < 0 ? dir_rsrl : dir_rslr;
-	struct sbuf str = {0};
 	int grp;
-	int flg = (beg ? RE_NOTBOL : 0) | (chrs[end][0] ? RE_NOTEOL : 0);
+	int flg = RE_STARTEND | (beg ? RE_NOTBOL : 0) | (chrs[end][0] ? RE_NOTEOL : 0);
 	int found = -1;
-	sbuf_mem(&str, chrs[beg], chrs[end] - chrs[beg]);
+	subs[0] = chrs[beg] - chrs[0];
+	subs[1] = chrs[end] - chrs[0];
 	if (rs)
-		found = rset_find(rs, sbuf_buf(&str), LEN(subs) / 2, subs, flg);
+		found = rset_find(rs, chrs[0], LEN(subs) / 2, subs, flg);
 	if (found >= 0 && r_beg && r_end && c_beg && c_end) {
-		char *s = sbuf_buf(&str);
 		conf_dirmark(found, NULL, NULL, dir, &grp);
-		*r_beg = beg + uc_off(s, subs[0]);
-		*r_end = beg + uc_off(s, subs[1]);
+		*r_beg = dir_idx(chrs, beg, end, subs[0]);
+		*r_end = dir_idx(chrs, beg, end, subs[1]);
 		*c_beg = subs[grp * 2 + 0] >= 0 ?
-			beg + uc_off(s, subs[grp * 2 + 0]) : *r_beg;
+			dir_idx(chrs, beg, end, subs[grp * 2 + 0]) : *r_beg;
 		*c_end = subs[grp * 2 + 1] >= 0 ?
-			beg + uc_off(s, subs[grp * 2 + 1]) : *r_end;
+			dir_idx(chrs, beg, end, subs[grp * 2 + 1]) : *r_end;
 		*rec = grp > 0;
 	}
-	sbuf_free(&str);
 	return found < 0;
 }
 
@@ -83,18 +95,52 @@ int dir_context(char *s)
 	return xtd < 0 ? -1 : +1;
 }
 
+#define DIRCACHE	64
+
+/* recently computed orders */
+static struct dircache {
+	char *s;
+	int td;
+	int n;
+	int *ord;
+} dircache[DIRCACHE];
+
+static unsigned dir_hash(char *s)
+{
+	unsigned h = 5381;
+	while (*s)
+		h = h * 33 + (unsigned char) *s++;
+	return h;
+}
+
 /* reorder the characters in s */
 void dir_reorder(char *s, int *ord)
 {
-	int n;
-	char **chrs = uc_chop(s, &n);
-	int dir = dir_context(s);
+	struct dircache *dc = &dircache[(dir_hash(s) + xtd) % DIRCACHE];
+	char **chrs;
+	int dir, n;
+	PROF_BEG(PROF_DIR);
+	if (dc->s && dc->td == xtd && !strcmp(dc->s, s)) {
+		memcpy(ord, dc->ord, dc->n * sizeof(ord[0]));
+		PROF_END(PROF_DIR, dc->n);
+		return;
+	}
+	chrs = uc_chop(s, &n);
+	dir = dir_context(s);
+	free(dc->s);
+	free(dc->ord);
+	dc->s = uc_dup(s);
+	dc->td = xtd;
+	dc->n = n;
 	if (n && chrs[n - 1][0] == '\n') {
 		ord[n - 1] = n - 1;
 		n--;
 	}
 	dir_fix(chrs, ord, dir, 0, n);
+	dc->ord = malloc(dc->n * sizeof(ord[0]));
+	memcpy(dc->ord, ord, dc->n * sizeof(ord[0]));
 	free(chrs);
+	PROF_END(PROF_DIR, dc->n);
 }
 
 void dir_init(void)
@@ -117,10 +163,15 @@ void dir_init(void)
 
 void dir_done(void)
 {
+	int i;
 	if (dir_rslr)
 		rset_free(dir_rslr);
 	if (dir_rsrl)
 		rset_free(dir_rsrl);
 	if (dir_rsctx)
 		rset_free(dir_rsctx);
+	for (i = 0; i < DIRCACHE; i++) {
+		free(dircache[i].s);
+		free(dircache[i].ord);
+	}
 }
@@ -0,0 +1,170 @@
+/* the event loop: file descriptors and timers served while waiting */
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include "vi.h"
+
+#define EVFDS		16	/* registered file descriptors */
+#define EVTIMERS	16	/* pending timers */
+
+static struct evfd {
+	int fd;
+	int events;
+	void (*cb)(int fd, int revents, void *dat);
+	void *dat;
+} evfds[EVFDS];
+static int evfds_n;
+
+static struct evtimer {
+	long when;		/* the deadline in milliseconds; zero if unused */
+	void (*cb)(void *dat);
+	void *dat;
+} evtimers[EVTIMERS];
+
+static int ev_depth;		/* callbacks are not invoked recursively */
+
+static long ev_msec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* call cb when fd is ready for events; replaces the previous registration */
+int ev_add(int fd, int events, void (*cb)(int fd, int revents, void *dat), void *dat)
+{
+	int i;
+	for (i = 0; i < evfds_n && evfds[i].fd != fd; i++)
+		;
+	if (i == EVFDS)
+		return 1;
+	if (i == evfds_n)
+		evfds_n++;
+	evfds[i].fd = fd;
+	evfds[i].events = events;
+	evfds[i].cb = cb;
+	evfds[i].dat = dat;
+	return 0;
+}
+
+void ev_del(int fd)
+{
+	int i;
+	for (i = 0; i < evfds_n; i++) {
+		if (evfds[i].fd == fd) {
+			evfds[i] = evfds[--evfds_n];
+			return;
+		}
+	}
+}
+
+/* call cb after msec milliseconds; returns a timer identifier or -1 */
+int ev_timer(int msec, void (*cb)(void *dat), void *dat)
+{
+	int i;
+	for (i = 0; i < EVTIMERS; i++) {
+		if (!evtimers[i].when) {
+			evtimers[i].when = ev_msec() + MAX(1, msec);
+			evtimers[i].cb = cb;
+			evtimers[i].dat = dat;
+			return i;
+		}
+	}
+	return -1;
+}
+
+void ev_untimer(int id)
+{
+	if (id >= 0 && id < EVTIMERS)
+		evtimers[id].when = 0;
+}
+
+/* milliseconds until the next timer or -1 */
+static int ev_next(long now)
+{
+	long next = -1;
+	int i;
+	for (i = 0; i < EVTIMERS; i++)
+		if (evtimers[i].when && (next < 0 || evtimers[i].when - now < next))
+			next = MAX(0, evtimers[i].when - now);
+	return next;
+}
+
+/* invoke expired timers; returns nonzero if any */
+static int ev_timers(long now)
+{
+	int ran = 0;
+	int i;
+	for (i = 0; i < EVTIMERS; i++) {
+		if (evtimers[i].when && evtimers[i].when <= now) {
+			evtimers[i].when = 0;
+			evtimers[i].cb(evtimers[i].dat);
+			ran = 1;
+		}
+	}
+	return ran;
+}
+
+static int ev_registered(int fd, void (*cb)(int fd, int revents, void *dat))
+{
+	int i;
+	for (i = 0; i < evfds_n; i++)
+		if (evfds[i].fd == fd && evfds[i].cb == cb)
+			return 1;
+	return 0;
+}
+
+/*
+ * Like poll(), but serve registered file descriptors and timers while
+ * waiting.  Returns the number of ready entries of fds, zero on timeout
+ * and -1 on error.  If n is zero, it returns after the first event.
+ */
+int ev_poll(struct pollfd *fds, int n, int timeout)
+{
+	struct pollfd all[EVFDS + 8];
+	struct evfd reg[EVFDS];
+	long end = timeout > 0 ? ev_msec() + timeout : 0;
+	int nreg, ran, wait, next;
+	int i, ret;
+	if (n > LEN(all) - EVFDS)
+		return poll(fds, n, timeout);
+	while (1) {
+		long now = ev_msec();
+		nreg = ev_depth ? 0 : evfds_n;
+		memcpy(reg, evfds, nreg * sizeof(reg[0]));
+		memcpy(all, fds, n * sizeof(all[0]));
+		for (i = 0; i < nreg; i++) {
+			all[n + i].fd = reg[i].fd;
+			all[n + i].events = reg[i].events;
+		}
+		wait = timeout > 0 ? MAX(0, end - now) : timeout;
+		next = ev_depth ? -1 : ev_next(now);
+		if (next >= 0 && (wait < 0 || next < wait))
+			wait = next;
+		if (poll(all, n + nreg, wait) < 0)
+			return -1;
+		ran = 0;
+		if (!ev_depth) {
+			ev_depth++;
+			for (i = 0; i < nreg; i++) {
+				if (all[n + i].revents && ev_registered(reg[i].fd, reg[i].cb)) {
+					reg[i].cb(reg[i].fd, all[n + i].revents, reg[i].dat);
+					ran = 1;
+				}
+			}
+			if (ev_timers(ev_msec()))
+				ran = 1;
+			ev_depth--;
+		}
+		ret = 0;
+		for (i = 0; i < n; i++) {
+			fds[i].revents = all[i].revents;
+			if (all[i].revents)
+				ret++;
+		}
+		if (ret || timeout == 0 || (n == 0 && ran))
+			return ret;
+		if (timeout > 0 && ev_msec() >= end)
+			return 0;
+	}
+}
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include "vi.h"
 
@@ -29,7 +30,9 @@ int xlim = 256;			/* do not process lines longer than this */
 int xru = 1;			/* show line number */
 int xhist = 0;			/* number of history lines */
 int xvte = 0;			/* workaround for vte-based terminals */
+int xsync = 1;			/* use synchronized terminal updates */
 int xts = 8;			/* tabstop */
+int xbufmem = 64;		/* megabytes of unmodified buffers kept in memory */
 static char xkwd[EXLEN];	/* the last searched keyword */
 static char xrep[EXLEN];	/* the last replacement */
 static int xkwddir;		/* the last search direction */
@@ -37,114 +40,236 @@ static int xgdep;		/* global command recursion depth */
 static char **next;		/* argument list */
 static int next_pos;		/* position in argument list */
 
+#define BUFSHASH	1024		/* buffer hash table buckets */
+#define BUFMARKS	"abcdefghijklmnopqrstuvwxyz'*[]^"	/* marks kept when unloaded */
+
 static struct buf {
 	char ft[32];		/* file type */
 	char *path;		/* file path */
-	struct lbuf *lb;
+	struct lbuf *lb;	/* buffer lines; NULL if unloaded */
 	int row, off, top, left;
-	short id;		/* buffer number */
+	int mark[sizeof(BUFMARKS)];	/* marks of an unloaded buffer */
+	int mark_off[sizeof(BUFMARKS)];
+	int id;			/* buffer number */
 	short td;		/* text direction */
 	long mtime;		/* modification time */
-} bufs[16];
+	int pos;		/* index in bufs[] */
+	struct buf *hpath;	/* the next buffer in bufs_hpath[] */
+	struct buf *hid;	/* the next buffer in bufs_hid[] */
+} **bufs;			/* buffers; the most recently used first */
 
-static int bufs_cnt = 0;	/* number of allocated buffers */
+static int bufs_n;		/* number of buffers */
+static int bufs_sz;		/* size of bufs[] */
+static int bufs_cnt = 0;	/* the last buffer number */
+static struct buf *bufs_hpath[BUFSHASH];	/* buffers by path */
+static struct buf *bufs_hid[BUFSHASH];		/* buffers by number */
 
-static void bufs_free(int idx)
+static long mtime(char *path);
+
+static int bufs_hash(char *s)
+{
+	unsigned h = 0;
+	while (*s)
+		h = h * 31 + (unsigned char) *s++;
+	return h % BUFSHASH;
+}
+
+static void bufs_link(struct buf *b)
 {
-	if (bufs[idx].lb) {
-		free(bufs[idx].path);
-		lbuf_free(bufs[idx].lb);
-		memset(&bufs[idx], 0, sizeof(bufs[idx]));
+	int h = bufs_hash(b->path);
+	b->hpath = bufs_hpath[h];
+	bufs_hpath[h] = b;
+	b->hid = bufs_hid[b->id % BUFSHASH];
+	bufs_hid[b->id % BUFSHASH] = b;
+}
+
+static void bufs_unlink(struct buf *b)
+{
+	struct buf **p;
+	for (p = &bufs_hpath[bufs_hash(b->path)]; *p; p = &(*p)->hpath) {
+		if (*p == b) {
+			*p = b->hpath;
+			break;
+		}
+	}
+	for (p = &bufs_hid[b->id % BUFSHASH]; *p; p = &(*p)->hid) {
+		if (*p == b) {
+			*p = b->hid;
+			break;
+		}
 	}
 }
 
-static int bufs_find(char *path)
+/* move bufs[beg..end) to bufs[beg + n..end + n) */
+static void bufs_move(int beg, int end, int n)
 {
 	int i;
+	memmove(bufs + beg + n, bufs + beg, (end - beg) * sizeof(bufs[0]));
+	for (i = beg + n; i < end + n; i++)
+		bufs[i]->pos = i;
+}
+
+static void bufs_free(int idx)
+{
+	struct buf *b = bufs[idx];
+	bufs_unlink(b);
+	free(b->path);
+	if (b->lb)
+		lbuf_free(b->lb);
+	free(b);
+	bufs_move(idx + 1, bufs_n, -1);
+	bufs[--bufs_n] = NULL;
+}
+
+static int bufs_find(char *path)
+{
+	struct buf *b;
 	path = path[0] == '/' && path[1] == '\0' ? "" : path;
-	for (i = 0; i < LEN(bufs); i++)
-		if (bufs[i].path && !strcmp(bufs[i].path, path))
-			return i;
+	for (b = bufs_hpath[bufs_hash(path)]; b; b = b->hpath)
+		if (!strcmp(b->path, path))
+			return b->pos;
+	return -1;
+}
+
+static int bufs_findid(int id)
+{
+	struct buf *b;
+	for (b = bufs_hid[id % BUFSHASH]; b; b = b->hid)
+		if (b->id == id)
+			return b->pos;
 	return -1;
 }
 
-static int bufs_findroom(void)
+/* append a new buffer to bufs[] */
+static int bufs_open(char *path)
+{
+	struct buf *b;
+	path = path[0] == '/' && path[1] == '\0' ? "" : path;
+	if (bufs_n + 1 >= bufs_sz) {
+		int sz = bufs_sz + (bufs_sz ? bufs_sz : 16);
+		struct buf **nbufs = malloc(sz * sizeof(nbufs[0]));
+		memcpy(nbufs, bufs, bufs_n * sizeof(bufs[0]));
+		memset(nbufs + bufs_n, 0, (sz - bufs_n) * sizeof(bufs[0]));
+		free(bufs);
+		bufs = nbufs;
+		bufs_sz = sz;
+	}
+	b = malloc(sizeof(*b));
+	memset(b, 0, sizeof(*b));
+	b->id = ++bufs_cnt;
+	b->path = uc_dup(path);
+	b->lb = lbuf_make();
+	b->td = +1;
+	b->mtime = -1;
+	b->pos = bufs_n;
+	strcpy(b->ft, syn_filetype(path));
+	bufs[bufs_n++] = b;
+	bufs_link(b);
+	return b->pos;
+}
+
+/* restore the marks saved in bufs_unload() */
+static void bufs_marks(struct buf *b)
 {
 	int i;
-	for (i = 0; i < LEN(bufs) - 1; i++)
-		if (!bufs[i].lb)
-			break;
-	return i;
+	for (i = 0; BUFMARKS[i]; i++)
+		if (b->mark[i] >= 0 && b->mark[i] < lbuf_len(b->lb))
+			lbuf_mark(b->lb, (unsigned char) BUFMARKS[i], b->mark[i], b->mark_off[i]);
 }
 
-static void bufs_init(int idx, char *path)
+/* read an unloaded buffer again */
+static void bufs_reload(struct buf *b)
 {
-	bufs_free(idx);
-	bufs[idx].id = ++bufs_cnt;
-	bufs[idx].path = uc_dup(path);
-	bufs[idx].lb = lbuf_make();
-	bufs[idx].row = 0;
-	bufs[idx].off = 0;
-	bufs[idx].top = 0;
-	bufs[idx].left = 0;
-	bufs[idx].td = +1;
-	bufs[idx].mtime = -1;
-	strcpy(bufs[idx].ft, syn_filetype(path));
+	int fd;
+	if (!(b->lb = pre_take(b->path))) {
+		fd = open(b->path, O_RDONLY);
+		b->lb = lbuf_make();
+		if (fd >= 0) {
+			if (lbuf_rd(b->lb, fd, 0, 0))
+				ex_show("e: read failed");
+			close(fd);
+		}
+	}
+	lbuf_saved(b->lb, 1);
+	b->mtime = mtime(b->path);
+	bufs_marks(b);
+	b->row = MAX(0, MIN(b->row, lbuf_len(b->lb) - 1));
+	b->top = MAX(0, MIN(b->top, lbuf_len(b->lb) - 1));
+	b->off = 0;
 }
 
-static int bufs_open(char *path)
+/* unload the least recently used unmodified buffers above xbufmem */
+static void bufs_unload(void)
 {
-	int idx = bufs_findroom();
-	path = path[0] == '/' && path[1] == '\0' ? "" : path;
-	bufs_init(idx, path);
-	return idx;
+	long mem = 0;
+	int i;
+	for (i = 0; i < bufs_n; i++)
+		if (bufs[i]->lb)
+			mem += lbuf_size(bufs[i]->lb);
+	/* the current and the alternate buffers are kept */
+	for (i = bufs_n - 1; i >= 2 && mem > (long) xbufmem << 20; i--) {
+		struct buf *b = bufs[i];
+		if (b->lb && b->path[0] && !lbuf_modified(b->lb)) {
+			int j;
+			for (j = 0; BUFMARKS[j]; j++)
+				if (lbuf_jump(b->lb, (unsigned char) BUFMARKS[j], &b->mark[j], &b->mark_off[j]))
+					b->mark[j] = -1;
+			mem -= lbuf_size(b->lb);
+			lbuf_free(b->lb);
+			b->lb = NULL;
+		}
+	}
 }
 
 static void bufs_store(void)
 {
-	bufs[0].row = xrow;
-	bufs[0].off = xoff;
-	bufs[0].top = xtop;
-	bufs[0].left = xleft;
-	bufs[0].td = xtd;
+	bufs[0]->row = xrow;
+	bufs[0]->off = xoff;
+	bufs[0]->top = xtop;
+	bufs[0]->left = xleft;
+	bufs[0]->td = xtd;
 }
 
 static void bufs_load(void)
 {
-	xrow = bufs[0].row;
-	xoff = bufs[0].off;
-	xtop = bufs[0].top;
-	xleft = bufs[0].left;
-	xtd = bufs[0].td;
-	reg_put('%', bufs[0].path ? bufs[0].path : "", 0);
+	if (!bufs[0]->lb)
+		bufs_reload(bufs[0]);
+	xrow = bufs[0]->row;
+	xoff = bufs[0]->off;
+	xtop = bufs[0]->top;
+	xleft = bufs[0]->left;
+	xtd = bufs[0]->td;
+	reg_put('%', bufs[0]->path, 0);
 }
 
 static void bufs_shift(void)
 {
 	bufs_free(0);
-	memmove(&bufs[0], &bufs[1], sizeof(bufs) - sizeof(bufs[0]));
-	memset(&bufs[LEN(bufs) - 1], 0, sizeof(bufs[0]));
-	bufs_load();
+	if (bufs_n)
+		bufs_load();
 }
 
 static void bufs_switch(int idx)
 {
-	struct buf tmp;
+	struct buf *b = bufs[idx];
 	bufs_store();
-	memcpy(&tmp, &bufs[idx], sizeof(tmp));
-	memmove(&bufs[1], &bufs[0], sizeof(tmp) * idx);
-	memcpy(&bufs[0], &tmp, sizeof(tmp));
+	bufs_move(0, idx, 1);
+	bufs[0] = b;
+	b->pos = 0;
 	bufs_load();
+	bufs_unload();
 }
 
 static void bufs_number(void)
 {
-	int n = 0;
 	int i;
-	for (i = 0; i < LEN(bufs); i++)
-		if (bufs[i].lb != NULL)
-			bufs[i].id = ++n;
-	bufs_cnt = n;
+	memset(bufs_hid, 0, sizeof(bufs_hid));
+	memset(bufs_hpath, 0, sizeof(bufs_hpath));
+	for (i = bufs_n - 1; i >= 0; i--) {
+		bufs[i]->id = i + 1;
+		bufs_link(bufs[i]);
+	}
+	bufs_cnt = bufs_n;
 }
 
 static long mtime(char *path)
@@ -157,22 +282,22 @@ static long mtime(char *path)
 
 char *ex_path(void)
 {
-	return bufs[0].path;
+	return bufs_n ? bufs[0]->path : NULL;
 }
 
 int ex_id(void)
 {
-	return bufs[0].id;
+	return bufs_n ? bufs[0]->id : 0;
 }
 
 struct lbuf *ex_lbuf(void)
 {
-	return bufs[0].lb;
+	return bufs_n ? bufs[0]->lb : NULL;
 }
 
 char *ex_filetype(void)
 {
-	return bufs[0].ft;
+	return bufs_n ? bufs[0]->ft : "";
 }
 
 /* replace % and # with current and alternate path names; returns a static buffer */
@@ -183,14 +308,14 @@ static char *ex_pathexpand(char *src, int spaceallowed)
 	while (*src && *src != '\n' && (spaceallowed || (*src != ' ' && *src != '\t'))) {
 		if (*src == '%' || *src == '#') {
 			int idx = *src == '#';
-			if (!bufs[idx].path) {
+			if (idx >= bufs_n) {
 				ex_show("pathname \"%%\" or \"#\" is not set");
 				return NULL;
 			}
-			sbuf_str(&sb, bufs[idx].path[0] ? bufs[idx].path : "/");
+			sbuf_str(&sb, bufs[idx]->path[0] ? bufs[idx]->path : "/");
 			src++;
 		} else if (sbuf_len(&sb) == 0 && *src == '=') {
-			char *cur = bufs[0].path;
+			char *cur = ex_path();
 			char *dir = cur != NULL ? strrchr(cur, '/') : NULL;
 			if (cur != NULL && dir != NULL) {
 				sbuf_mem(&sb, cur, dir - cur);
@@ -379,7 +504,7 @@ static char *lbuf_write(struct lbuf *lb, int beg, int end, char *path, int force
 
 static char *bufs_save(int idx, int force)
 {
-	struct buf *b = &bufs[idx];
+	struct buf *b = bufs[idx];
 	char *err = lbuf_write(b->lb, 0, -1, b->path, force, b->mtime);
 	if (err)
 		return err;
@@ -391,8 +516,8 @@ static char *bufs_save(int idx, int force)
 
 static int bufs_modified(int idx, char *msg)
 {
-	struct buf *b = &bufs[idx];
-	if (!b->lb || !lbuf_modified(b->lb))
+	struct buf *b = idx < bufs_n ? bufs[idx] : NULL;
+	if (!b || !b->lb || !lbuf_modified(b->lb))
 		return 0;
 	if (xaw && b->path[0])
 		return bufs_save(idx, 0) != NULL;
@@ -408,18 +533,20 @@ static int ec_buffer(char *loc, char *cmd, char *arg, char *txt)
 	int i;
 	if (!arg[0]) {
 		/* print buffer list */
-		for (i = 0; i < LEN(bufs) && bufs[i].lb; i++) {
+		for (i = 0; i < bufs_n; i++) {
 			char c = i < strlen(aliases) ? aliases[i] : ' ';
-			char m = lbuf_modified(bufs[i].lb) ? '*' : ' ';
+			char m = bufs[i]->lb && lbuf_modified(bufs[i]->lb) ? '*' : ' ';
 			snprintf(ln, LEN(ln), "%2i %c %s %c",
-					(int) bufs[i].id, c, bufs[i].path, m);
+					bufs[i]->id, c, bufs[i]->path, m);
 			ex_print(ln);
 		}
 	} else if (arg[0] == '!') {
 		/* delete buffer */
 		bufs_shift();
-		if (bufs[0].lb == NULL)
-			bufs_init(0, "");
+		if (!bufs_n) {
+			bufs_open("");
+			bufs_load();
+		}
 	} else if (arg[0] == '~') {
 		/* reassign buffer ids */
 		bufs_number();
@@ -428,24 +555,22 @@ static int ec_buffer(char *loc, char *cmd, char *arg, char *txt)
 		int idx = -1;
 		/* switch to the given buffer */
 		if (isdigit((unsigned char) arg[0])) {	/* buffer id given */
-			for (idx = 0; idx < LEN(bufs); idx++)
-				if (bufs[idx].lb && id == bufs[idx].id)
-					break;
+			idx = bufs_findid(id);
 		} else if (arg[0] == '-') {		/* previous buffer */
-			for (i = 0; i < LEN(bufs); i++)
-				if (bufs[i].lb && bufs[i].id < bufs[0].id)
-					if (idx < 0 || bufs[i].id > bufs[idx].id)
+			for (i = 0; i < bufs_n; i++)
+				if (bufs[i]->id < bufs[0]->id)
+					if (idx < 0 || bufs[i]->id > bufs[idx]->id)
 						idx = i;
 		} else if (arg[0] == '+') {		/* next buffer */
-			for (i = 0; i < LEN(bufs); i++)
-				if (bufs[i].lb && bufs[i].id > bufs[0].id)
-					if (idx < 0 || bufs[i].id < bufs[idx].id)
+			for (i = 0; i < bufs_n; i++)
+				if (bufs[i]->id > bufs[0]->id)
+					if (idx < 0 || bufs[i]->id < bufs[idx]->id)
 						idx = i;
 		} else {				/* buffer alias given */
 			char *r = strchr(aliases, (unsigned char) arg[0]);
 			idx = r ? r - aliases : -1;
 		}
-		if (idx >= 0 && idx < LEN(bufs) && bufs[idx].lb) {
+		if (idx >= 0 && idx < bufs_n) {
 			if (!strchr(cmd, '!') && bufs_modified(0, "b: buffer modified"))
 				return 1;
 			bufs_switch(idx);
@@ -460,13 +585,14 @@ static int ec_buffer(char *loc, char *cmd, char *arg, char *txt)
 int ex_list(char **ls, int size)
 {
 	int i;
-	for (i = 0; i < LEN(bufs) && bufs[i].lb && i < size; i++)
-		ls[i] = bufs[i].path[0] ? bufs[i].path : "/";
+	for (i = 0; i < bufs_n && i < size; i++)
+		ls[i] = bufs[i]->path[0] ? bufs[i]->path : "/";
 	return i;
 }
 
 static int ec_edit(char *loc, char *cmd, char *arg, char *txt)
 {
+	struct lbuf *lb = NULL;
 	char *path, *pls;
 	int fd;
 	if (!strchr(cmd, '!') && bufs_modified(0, "e: buffer modified"))
@@ -484,10 +610,15 @@ static int ec_edit(char *loc, char *cmd, char *arg, char *txt)
 			return ex_command(pls + 1);
 		return 0;
 	}
-	if (path[0] || !bufs[0].path)
+	if (path[0] || !bufs_n) {
 		bufs_switch(bufs_open(path));
-	fd = open(ex_path(), O_RDONLY);
-	if (fd >= 0) {
+		lb = path[0] ? pre_take(path) : NULL;
+	}
+	if (lb) {
+		lbuf_free(bufs[0]->lb);
+		bufs[0]->lb = lb;
+		ex_show("R%04d <%s", lbuf_len(xb), ex_path());
+	} else if ((fd = open(ex_path(), O_RDONLY)) >= 0) {
 		int rd = lbuf_rd(xb, fd, 0, lbuf_len(xb));
 		close(fd);
 		if (rd)
@@ -496,7 +627,7 @@ static int ec_edit(char *loc, char *cmd, char *arg, char *txt)
 			ex_show("R%04d <%s", lbuf_len(xb), ex_path());
 	}
 	lbuf_saved(xb, path[0] != '\0');
-	bufs[0].mtime = mtime(ex_path());
+	bufs[0]->mtime = mtime(ex_path());
 	xrow = MAX(0, MIN(xrow, lbuf_len(xb) - 1));
 	xoff = 0;
 	xtop = MAX(0, MIN(xtop, lbuf_len(xb) - 1));
@@ -505,6 +636,29 @@ static int ec_edit(char *loc, char *cmd, char *arg, char *txt)
 	return 0;
 }
 
+/* whether path is not an open buffer or is unloaded */
+static int ex_unloaded(char *path)
+{
+	int idx = bufs_find(path);
+	return idx < 0 || !bufs[idx]->lb;
+}
+
+/* read the neighbouring files of the argument list in the background */
+static void ex_prefetch(void)
+{
+	char *ls[PRECNT];
+	int n = 0;
+	int i;
+	if (next_pos < 0 || !next[next_pos])
+		return;
+	for (i = next_pos + 1; next[i] && n < PRECNT - 1; i++)
+		if (ex_unloaded(next[i]))
+			ls[n++] = next[i];
+	if (next_pos > 0 && ex_unloaded(next[next_pos - 1]))
+		ls[n++] = next[next_pos - 1];
+	pre_fetch(ls, n);
+}
+
 static int ex_next(char *cmd, int dis)
 {
 	char sb_buf[EXLEN];
@@ -525,6 +679,7 @@ static int ex_next(char *cmd, int dis)
 	if (!sbuf_buf(&sb) || ec_edit("", cmd, sbuf_buf(&sb), NULL))
 		return 1;
 	next_pos = idx;
+	ex_prefetch();
 	return 0;
 }
 
@@ -551,7 +706,8 @@ static int ec_read(char *loc, char *cmd, char *arg, char *txt)
 	if (path[0] == '!') {
 		if (!path[1])
 			return 1;
-		obuf = cmd_pipe(path + 1, NULL, 1);
+		/* an empty input keeps the terminal for progress and ^C */
+		obuf = cmd_pipe(path + 1, "", 1);
 		if (obuf)
 			lbuf_edit(xb, obuf, pos, pos);
 		free(obuf);
@@ -595,7 +751,7 @@ static int ec_write(char *loc, char *cmd, char *arg, char *txt)
 		cmd_pipe(path + 1, ibuf, 0);
 		free(ibuf);
 	} else {
-		long ts = !strcmp(ex_path(), path) ? bufs[0].mtime : 0;
+		long ts = !strcmp(ex_path(), path) ? bufs[0]->mtime : 0;
 		char *err = lbuf_write(xb, beg, end, path, !!strchr(cmd, '!'), ts);
 		if (err != NULL) {
 			ex_show(err);
@@ -604,15 +760,17 @@ static int ec_write(char *loc, char *cmd, char *arg, char *txt)
 	}
 	ex_show("W%04d >%s", end - beg, path);
 	if (!ex_path()[0]) {
-		free(bufs[0].path);
-		bufs[0].path = uc_dup(path);
+		bufs_unlink(bufs[0]);
+		free(bufs[0]->path);
+		bufs[0]->path = uc_dup(path);
+		bufs_link(bufs[0]);
 		reg_put('%', path, 0);
 	}
 	if (!strcmp(ex_path(), path))
 		lbuf_saved(xb, 0);
 	if (!strcmp(ex_path(), path))
-		bufs[0].mtime = mtime(path);
-	lsp_modified(path, bufs[0].ft);
+		bufs[0]->mtime = mtime(path);
+	lsp_modified(path, bufs[0]->ft);
 	return 0;
 }
 
@@ -622,8 +780,8 @@ static int ec_quit(char *loc, char *cmd, char *arg, char *txt)
 	if (cmd[0] == 'w' || cmd[0] == 'x')
 		if (ec_write("", cmd, arg, NULL))
 			return 1;
-	for (i = 0; i < LEN(bufs); i++) {
-		if (bufs[i].lb) {
+	for (i = 0; i < bufs_n; i++) {
+		if (bufs[i]->lb) {
 			if (!strchr(cmd, 'a') && !strchr(cmd, '!')) {
 				if (bufs_modified(i, "q: buffer modified")) {
 					bufs_switch(i);
@@ -787,10 +945,59 @@ static void replace(struct sbuf *dst, char *rep, char *ln, int *offs)
 	}
 }
 
+/* lines searched by each thread of :s and :g */
+#define EXCHUNK		4096
+
+/* the match phase of :s and :g; lines are processed in parallel */
+struct exmatch {
+	struct rstr *re;
+	int beg;		/* the first line */
+	int all;		/* replace all matches (:s) */
+	char **rep;		/* the new lines (:s) */
+	char *mat;		/* matching lines (:g) */
+};
+
+/* the result of substituting xrep in ln or NULL if ln does not match */
+static char *ex_subst(struct rstr *re, char *ln, int all)
+{
+	struct sbuf sb = {0};
+	int offs[32];
+	while (rstr_find(re, ln, LEN(offs) / 2, offs, 0) >= 0) {
+		sbuf_mem(&sb, ln, offs[0]);
+		replace(&sb, xrep, ln, offs);
+		ln += offs[1];
+		if (offs[1] <= 0)	/* zero-length match */
+			sbuf_chr(&sb, (unsigned char) *ln++);
+		if (!*ln || *ln == '\n' || !all)
+			break;
+	}
+	if (!sb.s)
+		return NULL;
+	sbuf_str(&sb, ln);
+	return sbuf_done(&sb);
+}
+
+static void ex_substlines(void *dat, int beg, int end)
+{
+	struct exmatch *em = dat;
+	int i;
+	for (i = beg; i < end; i++)
+		em->rep[i] = ex_subst(em->re, lbuf_get(xb, em->beg + i), em->all);
+}
+
+static void ex_matchlines(void *dat, int beg, int end)
+{
+	struct exmatch *em = dat;
+	int offs[32];
+	int i;
+	for (i = beg; i < end; i++)
+		em->mat[i] = rstr_find(em->re, lbuf_get(xb, em->beg + i), LEN(offs) / 2, offs, 0) >= 0;
+}
+
 static int ec_substitute(char *loc, char *cmd, char *arg, char *txt)
 {
+	struct exmatch em = {NULL};
 	struct rstr *re;
-	int offs[32];
 	int beg, end;
 	char *pat = NULL, *rep = NULL;
 	char *s = arg;
@@ -813,24 +1020,19 @@ static int ec_substitute(char *loc, char *cmd, char *arg, char *txt)
 	re = rstr_make(pat, xic ? RE_ICASE : 0);
 	if (!re)
 		return 1;
+	em.re = re;
+	em.beg = beg;
+	em.all = strchr(s, 'g') != NULL;
+	em.rep = malloc((end - beg) * sizeof(em.rep[0]));
+	par_for(end - beg, EXCHUNK, ex_substlines, &em);
 	for (i = beg; i < end; i++) {
-		char *ln = lbuf_get(xb, i);
-		struct sbuf sb = {0};
-		while (rstr_find(re, ln, LEN(offs) / 2, offs, 0) >= 0) {
-			sbuf_mem(&sb, ln, offs[0]);
-			replace(&sb, xrep, ln, offs);
-			ln += offs[1];
-			if (offs[1] <= 0)	/* zero-length match */
-				sbuf_chr(&sb, (unsigned char) *ln++);
-			if (!*ln || *ln == '\n' || !strchr(s, 'g'))
-				break;
-		}
-		if (sb.s) {
-			sbuf_str(&sb, ln);
-			lbuf_edit(xb, sbuf_buf(&sb), i, i + 1);
-			sbuf_free(&sb);
+		if (em.rep[i - beg]) {
+			lbuf_batch(xb, em.rep[i - beg], i);
+			free(em.rep[i - beg]);
 		}
 	}
+	lbuf_batchdone(xb);
+	free(em.rep);
 	rstr_free(re);
 	return 0;
 }
@@ -838,7 +1040,6 @@ static int ec_substitute(char *loc, char *cmd, char *arg, char *txt)
 static int ec_exec(char *loc, char *cmd, char *arg, char *txt)
 {
 	int beg, end;
-	char *text;
 	char *rep;
 	char *ecmd;
 	if (!(ecmd = ex_pathexpand(arg, 1)))
@@ -851,11 +1052,9 @@ static int ec_exec(char *loc, char *cmd, char *arg, char *txt)
 	}
 	if (ex_region(loc, &beg, &end))
 		return 1;
-	text = lbuf_cp(xb, beg, end);
-	rep = cmd_pipe(ecmd, text, 1);
+	rep = cmd_filter(ecmd, xb, beg, end);
 	if (rep)
 		lbuf_edit(xb, rep, beg, end);
-	free(text);
 	free(rep);
 	return 0;
 }
@@ -900,6 +1099,17 @@ static int ec_make(char *loc, char *cmd, char *arg, char *txt)
 		return 1;
 	if (snprintf(make, sizeof(make), "make %s", target) >= sizeof(make))
 		return 1;
+	if (target[0] == '&') {		/* :make & runs in the background */
+		char *s = target + 1;
+		while (*s == ' ' || *s == '\t')
+			s++;
+		snprintf(make, sizeof(make), "make %s", s);
+		if (cmd_job(make)) {
+			ex_show("mak: cannot start job");
+			return 1;
+		}
+		return 0;
+	}
 	ex_print(NULL);
 	if (!(res = cmd_pipe(make, NULL, 2)))
 		return 1;
@@ -909,10 +1119,28 @@ static int ec_make(char *loc, char *cmd, char *arg, char *txt)
 	return 0;
 }
 
+static int ec_job(char *loc, char *cmd, char *arg, char *txt)
+{
+	char *state = cmd_jobstate();
+	if (strchr(cmd, '!')) {
+		cmd_jobkill();
+		return 0;
+	}
+	if (!arg[0]) {
+		ex_print(state ? state : "job: no jobs");
+		return 0;
+	}
+	if (cmd_job(arg)) {
+		ex_show("job: %s", state ? state : "cannot start job");
+		return 1;
+	}
+	return 0;
+}
+
 static int ec_ft(char *loc, char *cmd, char *arg, char *txt)
 {
 	if (arg[0])
-		snprintf(bufs[0].ft, sizeof(bufs[0].ft), "%s", arg);
+		snprintf(bufs[0]->ft, sizeof(bufs[0]->ft), "%s", arg);
 	else
 		ex_print(ex_filetype());
 	return 0;
@@ -929,6 +1157,18 @@ static int ec_cmap(char *loc, char *cmd, char *arg, char *txt)
 	return 0;
 }
 
+static int ec_lat(char *loc, char *cmd, char *arg, char *txt)
+{
+	lat_show();
+	return 0;
+}
+
+static int ec_stats(char *loc, char *cmd, char *arg, char *txt)
+{
+	prof_show();
+	return 0;
+}
+
 static char *ex_skip(char **arg)
 {
 	char *s = *arg;
@@ -998,13 +1238,17 @@ static int ec_mapchar(char *loc, char *cmd, char *arg, char *txt)
 	return 0;
 }
 
-static int ex_exec(char *ln);
+struct exprog;
+static struct exprog *ex_compile(char *ln);
+static void ex_progfree(struct exprog *prog);
+static int ex_run(struct exprog *prog);
 
 static int ec_glob(char *loc, char *cmd, char *arg, char *txt)
 {
 	char sb_buf[EXLEN];
+	struct exmatch em = {NULL};
+	struct exprog *prog;
 	struct rstr *re;
-	int offs[32];
 	int beg, end, not;
 	char *req = sb_buf;
 	char *pat;
@@ -1023,21 +1267,28 @@ static int ec_glob(char *loc, char *cmd, char *arg, char *txt)
 		return 1;
 	if (!(re = rstr_make(pat, xic ? RE_ICASE : 0)))
 		return 1;
+	em.re = re;
+	em.beg = beg;
+	em.mat = malloc(end - beg);
+	par_for(end - beg, EXCHUNK, ex_matchlines, &em);
 	xgdep++;
-	for (i = beg + 1; i < end; i++)
-		lbuf_globset(xb, i, xgdep);
+	for (i = beg; i < end; i++)
+		if (em.mat[i - beg] != not)
+			lbuf_globset(xb, i, xgdep);
+	free(em.mat);
+	prog = ex_compile(req);
 	i = beg;
-	while (i < lbuf_len(xb)) {
-		char *ln = lbuf_get(xb, i);
-		if ((rstr_find(re, ln, LEN(offs) / 2, offs, 0) < 0) == not) {
-			xrow = i;
-			if (ex_exec(req))
-				break;
-			i = MIN(i, xrow);
-		}
+	while (1) {
 		while (i < lbuf_len(xb) && !lbuf_globget(xb, i, xgdep))
 			i++;
+		if (i >= lbuf_len(xb))
+			break;
+		xrow = i;
+		if (ex_run(prog))
+			break;
+		i = MIN(i, xrow);
 	}
+	ex_progfree(prog);
 	for (i = 0; i < lbuf_len(xb); i++)
 		lbuf_globget(xb, i, xgdep);
 	xgdep--;
@@ -1299,6 +1550,34 @@ static int ec_crewind(char *loc, char *cmd, char *arg, char *txt)
 	return 0;
 }
 
+/* execute a register, reusing the parsed commands of the last one */
+static int ex_macro(char *buf)
+{
+	static char *last;		/* the text of the last register */
+	static struct exprog *prog;	/* its parsed commands */
+	static int dep;			/* nested executions */
+	struct exprog *cur;
+	int ret;
+	if (dep) {			/* prog may be in use */
+		cur = ex_compile(buf);
+	} else if (last && !strcmp(last, buf)) {
+		cur = prog;
+	} else {
+		if (prog)
+			ex_progfree(prog);
+		free(last);
+		last = uc_dup(buf);
+		cur = prog = ex_compile(buf);
+	}
+	dep++;
+	ret = ex_run(cur);
+	dep--;
+	if (cur != prog)
+		ex_progfree(cur);
+	lbuf_tx(xb);
+	return ret;
+}
+
 static int ec_at(char *loc, char *cmd, char *arg, char *txt)
 {
 	int beg, end;
@@ -1326,7 +1605,7 @@ static int ec_at(char *loc, char *cmd, char *arg, char *txt)
 		sbuf_free(&sb);
 		return ret;
 	}
-	return ex_command(buf);
+	return ex_macro(buf);
 }
 
 static int ec_source(char *loc, char *cmd, char *arg, char *txt)
@@ -1358,6 +1637,7 @@ static struct option {
 } options[] = {
 	{"ai", "autoindent", &xai},
 	{"aw", "autowrite", &xaw},
+	{"bm", "bufmem", &xbufmem},
 	{"hist", "history", &xhist},
 	{"hl", "highlight", &xhl},
 	{"hll", "highlightline", &xhll},
@@ -1366,6 +1646,7 @@ static struct option {
 	{"order", "order", &xorder},
 	{"ru", "ruler", &xru},
 	{"shape", "shape", &xshape},
+	{"sync", "synchronize", &xsync},
 	{"td", "textdirection", &xtd},
 	{"ts", "tabstop", &xts},
 	{"vte", "vte", &xvte},
@@ -1438,7 +1719,9 @@ static struct excmd {
 	{"g", "global", ec_glob, 1},
 	{"hl", "highlight", ec_highlight},
 	{"i", "insert", ec_insert},
+	{"job", "job", ec_job, 1},
 	{"k", "mark", ec_mark},
+	{"lat", "latency", ec_lat},
 	{"lsp", "lspopen", ec_lsp},
 	{"lspc", "lspclose", ec_lspclose},
 	{"lspf", "lspfind", ec_lspfind, 1},
@@ -1460,6 +1743,7 @@ static struct excmd {
 	{"ra", "ra", ec_at},
 	{"rk", "rk", ec_rk},
 	{"se", "set", ec_set},
+	{"stats", "stats", ec_stats},
 	{"s", "substitute", ec_substitute},
 	{"so", "source", ec_source},
 	{"ta", "tag", ec_tag, 1},
@@ -1621,29 +1905,94 @@ static char *ex_txt(char **src0, char *excmd)
 	return NULL;
 }
 
-/* execute a single ex command */
-static int ex_exec(char *ln)
+/* a parsed ex command */
+struct expcmd {
+	char *loc, *cmd, *arg;	/* addresses, name, and argument */
+	char *txt;		/* text input given with the command */
+	int idx;		/* index into excmds[] or -1 */
+};
+
+/* parsed ex commands, for executing them repeatedly */
+struct exprog {
+	struct expcmd *cmds;
+	int n;
+};
+
+static struct exprog *ex_compile(char *ln)
+{
+	struct exprog *prog = malloc(sizeof(*prog));
+	int sz = 0;
+	memset(prog, 0, sizeof(*prog));
+	while (*ln) {
+		struct expcmd *c;
+		char *abbr;
+		if (prog->n == sz) {
+			struct expcmd *cmds = malloc((sz + 4) * sizeof(cmds[0]));
+			memcpy(cmds, prog->cmds, prog->n * sizeof(cmds[0]));
+			free(prog->cmds);
+			prog->cmds = cmds;
+			sz += 4;
+		}
+		c = &prog->cmds[prog->n++];
+		c->loc = uc_dup(ex_loc(&ln));
+		c->cmd = uc_dup(ex_cmd(&ln));
+		c->idx = ex_idx(c->cmd);
+		abbr = c->idx >= 0 ? excmds[c->idx].abbr : "unknown";
+		c->arg = uc_dup(ex_arg(&ln, abbr));
+		/* text input is read from the terminal when executed */
+		c->txt = abbr[0] == 'r' && abbr[1] == 's' && ln[0] ? ex_txt(&ln, abbr) : NULL;
+	}
+	return prog;
+}
+
+static void ex_progfree(struct exprog *prog)
+{
+	int i;
+	for (i = 0; i < prog->n; i++) {
+		free(prog->cmds[i].loc);
+		free(prog->cmds[i].cmd);
+		free(prog->cmds[i].arg);
+		free(prog->cmds[i].txt);
+	}
+	free(prog->cmds);
+	free(prog);
+}
+
+/* execute parsed ex commands */
+static int ex_run(struct exprog *prog)
 {
+	char arg[EXLEN];
 	int ret = 0;
-	while (*ln && !ret) {
-		char *loc, *cmd, *arg, *txt;
-		int idx;
-		loc = ex_loc(&ln);
-		cmd = ex_cmd(&ln);
-		idx = cmd ? ex_idx(cmd) : -1;
-		arg = ex_arg(&ln, idx >= 0 ? excmds[idx].abbr : "unknown");
-		txt = ex_txt(&ln, idx >= 0 ? excmds[idx].abbr : "unknown");
-		if (idx >= 0 && arg) {
-			ret = excmds[idx].ec(loc, cmd, arg, txt);
-		} else {
-			ret = 1;
-			ex_show("unknown command %s", cmd);
+	int i;
+	for (i = 0; i < prog->n && !ret; i++) {
+		struct expcmd *c = &prog->cmds[i];
+		char *txt = c->txt;
+		if (c->idx < 0) {
+			ex_show("unknown command %s", c->cmd);
+			return 1;
+		}
+		if (!txt) {
+			char *src = "";
+			txt = ex_txt(&src, excmds[c->idx].abbr);
 		}
-		free(txt);
+		/* commands may modify their argument */
+		snprintf(arg, sizeof(arg), "%s", c->arg);
+		ret = excmds[c->idx].ec(c->loc, c->cmd, arg, txt);
+		if (txt != c->txt)
+			free(txt);
 	}
 	return ret;
 }
 
+/* execute a single ex command */
+static int ex_exec(char *ln)
+{
+	struct exprog *prog = ex_compile(ln);
+	int ret = ex_run(prog);
+	ex_progfree(prog);
+	return ret;
+}
+
 /* execute a single ex command */
 int ex_command(char *ln)
 {
@@ -1683,10 +2032,140 @@ int ex_init(char **files)
 	return 0;
 }
 
-void ex_done(void)
+/*
+ * Write lb to a temporary file and rename it to path.  Symbolic links
+ * are followed, and files with more than one hard link are written in
+ * place, to keep the links.
+ */
+static int ex_atomicwrite(struct lbuf *lb, char *path)
 {
+	char tmp[EXLEN];
+	char *real = realpath(path, NULL);
+	struct stat st;
+	int fd, err;
+	if (!real)
+		return 1;
+	if (!stat(real, &st) && st.st_nlink > 1) {
+		if ((fd = open(real, O_WRONLY | O_TRUNC)) < 0) {
+			free(real);
+			return 1;
+		}
+		err = lbuf_wr(lb, fd, 0, lbuf_len(lb)) || fsync(fd);
+		free(real);
+		return close(fd) || err;
+	}
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", real) >= sizeof(tmp) ||
+			(fd = mkstemp(tmp)) < 0) {
+		free(real);
+		return 1;
+	}
+	if (!stat(real, &st))
+		fchmod(fd, st.st_mode & 07777);
+	err = lbuf_wr(lb, fd, 0, lbuf_len(lb)) || fsync(fd);
+	if (close(fd) || err || rename(tmp, real)) {
+		unlink(tmp);
+		free(real);
+		return 1;
+	}
+	free(real);
+	return 0;
+}
+
+#define BATCH_SAME	0	/* the file was not modified */
+#define BATCH_WRITTEN	1	/* the file was modified and written */
+#define BATCH_FAILED	2	/* a command failed */
+#define BATCH_WRFAIL	3	/* the file could not be written */
+
+/* execute script on path in a child process; returns its pid */
+static int ex_batchfile(char *script, char *path)
+{
+	char *files[] = {path, NULL};
+	int pid = fork();
+	int ret = BATCH_SAME;
+	int fd;
+	if (pid)
+		return pid;
+	if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+		dup2(fd, 0);
+		dup2(fd, 1);
+		close(fd);
+	}
+	if (access(path, R_OK) || ex_init(files))
+		_exit(BATCH_FAILED);
+	lbuf_tx(xb);		/* separate the changes from reading the file */
+	if (ex_command(script))
+		ret = BATCH_FAILED;
+	else if (lbuf_modified(xb))
+		ret = ex_atomicwrite(xb, path) ? BATCH_WRFAIL : BATCH_WRITTEN;
+	fflush(stdout);
+	_exit(ret);
+}
+
+/*
+ * Execute the ex script in the given file on each of files, in
+ * parallel child processes with their own buffers and registers.
+ * Modified files are written atomically.  Prints the result of each
+ * file and returns nonzero if any failed.
+ */
+int ex_batch(char *path, char **files)
+{
+	static char *msgs[] = {"unchanged", "written", "failed", "write failed"};
+	long cnt[LEN(msgs)] = {0};
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	char buf[1 << 10];
+	struct sbuf sb = {0};
+	int *pids;
+	int n, next_file = 0, running = 0;
+	int fd = open(path, O_RDONLY);
+	long nr;
 	int i;
+	if (fd < 0) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+	while ((nr = read(fd, buf, sizeof(buf))) > 0)
+		sbuf_mem(&sb, buf, nr);
+	close(fd);
+	for (n = 0; files[n]; n++)
+		;
+	pids = malloc((n + 1) * sizeof(pids[0]));
+	fflush(stdout);
+	while (next_file < n || running > 0) {
+		int status, pid, res;
+		if (next_file < n && running < MAX(1, ncpu)) {
+			pids[next_file] = ex_batchfile(sbuf_buf(&sb), files[next_file]);
+			if (pids[next_file] > 0)
+				running++;
+			else
+				cnt[BATCH_FAILED]++;
+			if (pids[next_file] <= 0)
+				printf("%s: %s\n", files[next_file], msgs[BATCH_FAILED]);
+			next_file++;
+			continue;
+		}
+		if ((pid = wait(&status)) < 0)
+			break;
+		running--;
+		res = WIFEXITED(status) && WEXITSTATUS(status) < LEN(msgs) ?
+			WEXITSTATUS(status) : BATCH_FAILED;
+		cnt[res]++;
+		for (i = 0; i < next_file; i++)
+			if (pids[i] == pid)
+				printf("%s: %s\n", files[i], msgs[res]);
+	}
+	printf("%d files: %ld written, %ld unchanged, %ld failed\n", n,
+		cnt[BATCH_WRITTEN], cnt[BATCH_SAME], cnt[BATCH_FAILED] + cnt[BATCH_WRFAIL]);
+	free(pids);
+	sbuf_free(&sb);
+	return cnt[BATCH_FAILED] + cnt[BATCH_WRFAIL] > 0;
+}
+
+void ex_done(void)
+{
+	cmd_jobkill();
+	pre_done();
 	lsp_done();
-	for (i = 0; i < LEN(bufs); i++)
-		bufs_free(i);
+	while (bufs_n)
+		bufs_free(bufs_n - 1);
+	free(bufs);
 }
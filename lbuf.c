@@ -9,6 +9,12 @@
 #define NMARKS_BASE		('z' - 'a' + 3)
 #define NMARKS			32
 
+/* a line replaced in a batch */
+struct lbat {
+	int pos, n_ins;		/* the replaced line and the number of new lines */
+	long ins_len, del_len;	/* its portion of lopt's ins/del */
+};
+
 /* line operations */
 struct lopt {
 	char *ins, *del;	/* inserted/deleted text */
@@ -17,6 +23,8 @@ struct lopt {
 	int pos_off;		/* cursor line offset */
 	int seq;		/* operation number */
 	int *mark, *mark_off;	/* saved marks */
+	struct lbat *bat;	/* batched line replacements */
+	int bat_n;		/* number of entries in bat[] */
 };
 
 /* line buffers */
@@ -28,6 +36,7 @@ struct lbuf {
 	char *ln_glob;		/* line global mark */
 	int ln_n;		/* number of lines in ln[] */
 	int ln_sz;		/* size of ln[] */
+	long ln_bytes;		/* the total length of lines */
 	int useq;		/* current operation sequence */
 	struct lopt *hist;	/* buffer history */
 	int hist_sz;		/* size of hist[] */
@@ -35,6 +44,10 @@ struct lbuf {
 	int hist_u;		/* current undo head in hist[] */
 	int useq_zero;		/* useq for lbuf_saved() */
 	int useq_last;		/* useq before hist[] */
+	struct lbat *bat;	/* pending batched replacements */
+	int bat_n;		/* number of entries in bat[] */
+	int bat_sz;		/* size of bat[] */
+	struct sbuf bat_ins;	/* the text of pending replacements */
 };
 
 struct lbuf *lbuf_make(void)
@@ -54,6 +67,7 @@ static void lopt_done(struct lopt *lo)
 	free(lo->del);
 	free(lo->mark);
 	free(lo->mark_off);
+	free(lo->bat);
 }
 
 static void lbuf_savemark(struct lbuf *lb, struct lopt *lo, int m)
@@ -125,6 +139,8 @@ void lbuf_free(struct lbuf *lb)
 	free(lb->ln);
 	free(lb->ln_len);
 	free(lb->ln_glob);
+	free(lb->bat);
+	sbuf_free(&lb->bat_ins);
 	free(lb);
 }
 
@@ -143,13 +159,21 @@ static int linecount(char *s, long slen)
 	return n;
 }
 
-/* low-level line replacement */
-static void lbuf_replace(struct lbuf *lb, char *s, long slen, int pos, int n_del)
+/* allocate a line for the first l bytes of s */
+static char *lbuf_line(char *s, long l)
 {
-	int n_ins = linecount(s, slen);
-	char *e = s + slen;
-	int i;
-	while (lb->ln_n + n_ins - n_del >= lb->ln_sz) {
+	long l_nonl = l - (l > 0 && s[l - 1] == '\n');
+	char *n = malloc(l_nonl + 2);
+	memcpy(n, s, l_nonl);
+	n[l_nonl + 0] = '\n';
+	n[l_nonl + 1] = '\0';
+	return n;
+}
+
+/* make sure ln[] can hold n lines */
+static void lbuf_room(struct lbuf *lb, int n)
+{
+	while (n >= lb->ln_sz) {
 		int nsz = lb->ln_sz + (lb->ln_sz ? lb->ln_sz : 512);
 		char **nln = malloc(nsz * sizeof(nln[0]));
 		long *nln_len = malloc(nsz * sizeof(nln_len[0]));
@@ -165,8 +189,20 @@ static void lbuf_replace(struct lbuf *lb, char *s, long slen, int pos, int n_del
 		lb->ln_glob = nln_glob;
 		lb->ln_sz = nsz;
 	}
-	for (i = 0; i < n_del; i++)
+}
+
+/* low-level line replacement */
+static void lbuf_replace(struct lbuf *lb, char *s, long slen, int pos, int n_del)
+{
+	int n_ins = linecount(s, slen);
+	char *e = s + slen;
+	int i;
+	PROF_BEG(PROF_LBUF);
+	lbuf_room(lb, lb->ln_n + n_ins - n_del);
+	for (i = 0; i < n_del; i++) {
+		lb->ln_bytes -= lb->ln_len[pos + i];
 		free(lb->ln[pos + i]);
+	}
 	if (n_ins != n_del) {
 		memmove(lb->ln + pos + n_ins, lb->ln + pos + n_del,
 			(lb->ln_n - pos - n_del) * sizeof(lb->ln[0]));
@@ -178,13 +214,9 @@ static void lbuf_replace(struct lbuf *lb, char *s, long slen, int pos, int n_del
 	lb->ln_n += n_ins - n_del;
 	for (i = 0; i < n_ins; i++) {
 		long l = s ? linelength(s, e - s) : 0;
-		long l_nonl = l - (l > 0 && s[l - 1] == '\n');
-		char *n = malloc(l_nonl + 2);
-		memcpy(n, s, l_nonl);
-		n[l_nonl + 0] = '\n';
-		n[l_nonl + 1] = '\0';
-		lb->ln[pos + i] = n;
+		lb->ln[pos + i] = lbuf_line(s, l);
 		lb->ln_len[pos + i] = l;
+		lb->ln_bytes += l;
 		s += l;
 	}
 	for (i = n_del; i < n_ins; i++)
@@ -199,6 +231,97 @@ static void lbuf_replace(struct lbuf *lb, char *s, long slen, int pos, int n_del
 	}
 	lbuf_mark(lb, '[', pos, 0);
 	lbuf_mark(lb, ']', pos + (n_ins ? n_ins - 1 : 0), 0);
+	PROF_END(PROF_LBUF, slen);
+}
+
+/* apply or, if undo, revert the batched replacements of lo in one pass */
+static void lbuf_batchapply(struct lbuf *lb, struct lopt *lo, int undo)
+{
+	struct lbat *bat = lo->bat;
+	int n = lo->bat_n;
+	int *pos = malloc(n * sizeof(pos[0]));	/* edit location before the change */
+	int *cum = malloc(n * sizeof(cum[0]));	/* line count change before the edit */
+	int sz = lb->ln_sz, n_ln;
+	char **ln, *ln_glob;
+	long *ln_len;
+	char *s = undo ? lo->del : lo->ins;
+	int src = 0, dst = 0, d = 0;
+	int i, k;
+	PROF_BEG(PROF_LBUF);
+	for (i = 0; i < n; i++) {
+		cum[i] = d;
+		pos[i] = bat[i].pos - (undo ? d : 0);
+		d += undo ? 1 - bat[i].n_ins : bat[i].n_ins - 1;
+	}
+	n_ln = lb->ln_n + d;
+	while (n_ln >= sz)
+		sz += sz ? sz : 512;
+	ln = malloc(sz * sizeof(ln[0]));
+	ln_len = malloc(sz * sizeof(ln_len[0]));
+	ln_glob = malloc(sz * sizeof(ln_glob[0]));
+	for (i = 0; i < n; i++) {
+		int n_del = undo ? bat[i].n_ins : 1;
+		int n_ins = undo ? 1 : bat[i].n_ins;
+		char *e = s + (undo ? bat[i].del_len : bat[i].ins_len);
+		for (; src < pos[i]; src++, dst++) {
+			ln[dst] = lb->ln[src];
+			ln_len[dst] = lb->ln_len[src];
+			ln_glob[dst] = lb->ln_glob[src];
+		}
+		for (k = 0; k < n_ins; k++, dst++) {
+			long l = linelength(s, e - s);
+			ln[dst] = lbuf_line(s, l);
+			ln_len[dst] = l;
+			ln_glob[dst] = k < n_del ? lb->ln_glob[src + k] : 0;
+			lb->ln_bytes += l;
+			s += l;
+		}
+		for (k = 0; k < n_del; k++) {
+			lb->ln_bytes -= lb->ln_len[src];
+			free(lb->ln[src++]);
+		}
+		s = e;
+	}
+	for (; src < lb->ln_n; src++, dst++) {
+		ln[dst] = lb->ln[src];
+		ln_len[dst] = lb->ln_len[src];
+		ln_glob[dst] = lb->ln_glob[src];
+	}
+	for (i = 0; i < LEN(lb->mark); i++) {	/* updating marks */
+		int m = lb->mark[i];
+		int l = 0, h = n;
+		int n_del, n_ins;
+		while (l < h) {
+			int mid = (l + h) / 2;
+			if (pos[mid] <= m)
+				l = mid + 1;
+			else
+				h = mid;
+		}
+		if (m < 0 || l == 0)
+			continue;
+		l--;
+		n_del = undo ? bat[l].n_ins : 1;
+		n_ins = undo ? 1 : bat[l].n_ins;
+		if (m < pos[l] + n_del)
+			lb->mark[i] = pos[l] + cum[l] + MIN(m - pos[l], n_ins - 1);
+		else
+			lb->mark[i] = m + cum[l] + n_ins - n_del;
+	}
+	free(lb->ln);
+	free(lb->ln_len);
+	free(lb->ln_glob);
+	lb->ln = ln;
+	lb->ln_len = ln_len;
+	lb->ln_glob = ln_glob;
+	lb->ln_sz = sz;
+	lb->ln_n = n_ln;
+	lbuf_mark(lb, '[', pos[0] + cum[0], 0);
+	lbuf_mark(lb, ']', pos[n - 1] + cum[n - 1] +
+		MAX(0, (undo ? 1 : bat[n - 1].n_ins) - 1), 0);
+	free(pos);
+	free(cum);
+	PROF_END(PROF_LBUF, undo ? lo->del_len : lo->ins_len);
 }
 
 static char *lbuf_copy(struct lbuf *lb, int beg, int end, long *len)
@@ -213,17 +336,43 @@ static char *lbuf_copy(struct lbuf *lb, int beg, int end, long *len)
 	return sbuf_done(&sb);
 }
 
-/* append undo/redo history */
-static void lbuf_opt(struct lbuf *lb, char *s, long slen, int pos, int n_del)
+/* drop redo history and append an empty entry */
+static struct lopt *lbuf_hist(struct lbuf *lb)
 {
 	struct lopt *lo;
+	if (lb->hist_n == lb->hist_sz) {
+		int sz = lb->hist_sz + (lb->hist_sz ? lb->hist_sz : 128);
+		struct lopt *hist = malloc(sz * sizeof(hist[0]));
+		memcpy(hist, lb->hist, lb->hist_n * sizeof(hist[0]));
+		free(lb->hist);
+		lb->hist = hist;
+		lb->hist_sz = sz;
+	}
+	lo = &lb->hist[lb->hist_n];
+	lb->hist_n++;
+	lb->hist_u = lb->hist_n;
+	memset(lo, 0, sizeof(*lo));
+	lo->seq = lb->useq;
+	return lo;
+}
+
+static void lbuf_redodrop(struct lbuf *lb)
+{
 	int i;
 	for (i = lb->hist_u; i < lb->hist_n; i++)
 		lopt_done(&lb->hist[i]);
 	lb->hist_n = lb->hist_u;
+}
+
+/* append undo/redo history */
+static void lbuf_opt(struct lbuf *lb, char *s, long slen, int pos, int n_del)
+{
+	struct lopt *lo;
+	int i;
+	lbuf_redodrop(lb);
 	lo = &lb->hist[lb->hist_n - 1];
 	/* merging changes to the same line */
-	if (lb->hist_n > 0 && lo->seq == lb->useq && lo->pos == pos) {
+	if (lb->hist_n > 0 && lo->seq == lb->useq && lo->pos == pos && !lo->bat) {
 		if (lo->n_ins == 1 && n_del == 1 && linecount(s, slen) == 1) {
 			free(lo->ins);
 			lo->ins = s ? malloc(slen) : NULL;
@@ -235,18 +384,7 @@ static void lbuf_opt(struct lbuf *lb, char *s, long slen, int pos, int n_del)
 			return;
 		}
 	}
-	if (lb->hist_n == lb->hist_sz) {
-		int sz = lb->hist_sz + (lb->hist_sz ? lb->hist_sz : 128);
-		struct lopt *hist = malloc(sz * sizeof(hist[0]));
-		memcpy(hist, lb->hist, lb->hist_n * sizeof(hist[0]));
-		free(lb->hist);
-		lb->hist = hist;
-		lb->hist_sz = sz;
-	}
-	lo = &lb->hist[lb->hist_n];
-	lb->hist_n++;
-	lb->hist_u = lb->hist_n;
-	memset(lo, 0, sizeof(*lo));
+	lo = lbuf_hist(lb);
 	lo->pos = pos;
 	lo->n_del = n_del;
 	lo->del_len = 0;
@@ -254,7 +392,6 @@ static void lbuf_opt(struct lbuf *lb, char *s, long slen, int pos, int n_del)
 	lo->n_ins = s ? linecount(s, slen) : 0;
 	lo->ins = s ? uc_dup(s) : NULL;
 	lo->ins_len = slen;
-	lo->seq = lb->useq;
 	lbuf_savepos(lb, lo);
 	for (i = 0; i < NMARKS_BASE; i++)
 		if (lb->mark[i] >= pos && lb->mark[i] < pos + n_del)
@@ -279,6 +416,78 @@ void lbuf_edit(struct lbuf *lb, char *s, int beg, int end)
 	lbuf_editraw(lb, s, s ? strlen(s) : 0, beg, end);
 }
 
+/* queue replacing line pos with s; see lbuf_batchdone() */
+void lbuf_batch(struct lbuf *lb, char *s, int pos)
+{
+	struct lbat *b;
+	long len = strlen(s);
+	if (pos < 0 || pos >= lb->ln_n)
+		return;
+	if (lb->bat_n && lb->bat[lb->bat_n - 1].pos >= pos)
+		lbuf_batchdone(lb);
+	if (lb->bat_n == lb->bat_sz) {
+		int sz = lb->bat_sz + (lb->bat_sz ? lb->bat_sz : 128);
+		struct lbat *bat = malloc(sz * sizeof(bat[0]));
+		memcpy(bat, lb->bat, lb->bat_n * sizeof(bat[0]));
+		free(lb->bat);
+		lb->bat = bat;
+		lb->bat_sz = sz;
+	}
+	b = &lb->bat[lb->bat_n++];
+	b->pos = pos;
+	b->n_ins = linecount(s, len);
+	b->ins_len = len;
+	b->del_len = lb->ln_len[pos];
+	sbuf_mem(&lb->bat_ins, s, len);
+}
+
+/* whether line pos is replaced in the batch of lo */
+static int lbuf_batched(struct lopt *lo, int pos)
+{
+	int l = 0, h = lo->bat_n;
+	while (l < h) {
+		int m = (l + h) / 2;
+		if (lo->bat[m].pos < pos)
+			l = m + 1;
+		else
+			h = m;
+	}
+	return l < lo->bat_n && lo->bat[l].pos == pos;
+}
+
+/* apply queued replacements in one pass, as a single undo entry */
+void lbuf_batchdone(struct lbuf *lb)
+{
+	struct sbuf del = {0};
+	struct lopt *lo;
+	int i;
+	if (lb->bat_n == 1)
+		lbuf_editraw(lb, sbuf_buf(&lb->bat_ins), sbuf_len(&lb->bat_ins),
+			lb->bat[0].pos, lb->bat[0].pos + 1);
+	if (lb->bat_n > 1) {
+		lbuf_redodrop(lb);
+		lo = lbuf_hist(lb);
+		for (i = 0; i < lb->bat_n; i++)
+			sbuf_mem(&del, lb->ln[lb->bat[i].pos], lb->bat[i].del_len);
+		lo->pos = lb->bat[0].pos;
+		lo->del_len = sbuf_len(&del);
+		lo->del = sbuf_done(&del);
+		lo->ins_len = sbuf_len(&lb->bat_ins);
+		lo->ins = sbuf_done(&lb->bat_ins);
+		lo->bat = lb->bat;
+		lo->bat_n = lb->bat_n;
+		lb->bat = NULL;
+		lb->bat_sz = 0;
+		lbuf_savepos(lb, lo);
+		for (i = 0; i < NMARKS_BASE; i++)
+			if (lb->mark[i] >= 0 && lbuf_batched(lo, lb->mark[i]))
+				lbuf_savemark(lb, lo, i);
+		lbuf_batchapply(lb, lo, 0);
+	}
+	lb->bat_n = 0;
+	sbuf_cut(&lb->bat_ins, 0);
+}
+
 int lbuf_rd(struct lbuf *lbuf, int fd, int beg, int end)
 {
 	char buf[1 << 10];
@@ -370,7 +579,10 @@ int lbuf_undo(struct lbuf *lb)
 	useq = lb->hist[lb->hist_u - 1].seq;
 	while (lb->hist_u && lb->hist[lb->hist_u - 1].seq == useq) {
 		struct lopt *lo = &lb->hist[--(lb->hist_u)];
-		lbuf_replace(lb, lo->del, lo->del_len, lo->pos, lo->n_ins);
+		if (lo->bat)
+			lbuf_batchapply(lb, lo, 1);
+		else
+			lbuf_replace(lb, lo->del, lo->del_len, lo->pos, lo->n_ins);
 		lbuf_loadpos(lb, lo);
 		for (i = 0; i < LEN(lb->mark); i++)
 			lbuf_loadmark(lb, lo, i);
@@ -386,7 +598,10 @@ int lbuf_redo(struct lbuf *lb)
 	useq = lb->hist[lb->hist_u].seq;
 	while (lb->hist_u < lb->hist_n && lb->hist[lb->hist_u].seq == useq) {
 		struct lopt *lo = &lb->hist[lb->hist_u++];
-		lbuf_replace(lb, lo->ins, lo->ins_len, lo->pos, lo->n_del);
+		if (lo->bat)
+			lbuf_batchapply(lb, lo, 0);
+		else
+			lbuf_replace(lb, lo->ins, lo->ins_len, lo->pos, lo->n_del);
 		lbuf_loadpos(lb, lo);
 	}
 	return 0;
@@ -418,6 +633,16 @@ int lbuf_modified(struct lbuf *lb)
 	return lbuf_seq(lb) != lb->useq_zero;
 }
 
+/* the approximate memory used by the buffer and its history */
+long lbuf_size(struct lbuf *lb)
+{
+	long n = lb->ln_bytes + lb->ln_sz * (sizeof(lb->ln[0]) + sizeof(lb->ln_len[0]) + 1);
+	int i;
+	for (i = 0; i < lb->hist_n; i++)
+		n += lb->hist[i].ins_len + lb->hist[i].del_len;
+	return n;
+}
+
 /* start a new change set */
 void lbuf_tx(struct lbuf *lb)
 {
@@ -38,47 +38,56 @@ static void led_markrev(int n, char **chrs, int *pos, int *att)
 	}
 }
 
-/* render and print a line */
-void led_print(char *s0, int row, int cbeg, int cols, char *syn, char **old)
+/* draw the characters in the screen buffer */
+static void led_cells(char **chrs, int *off, int *att, int *shp,
+		int cbeg, int cend, int clast, int att_blank)
 {
-	int *pos;	/* pos[i]: the screen position of the i-th character */
-	int *off;	/* off[i]: the character at screen position i */
-	int *att;	/* att[i]: the attributes of i-th character */
-	char **chrs;	/* chrs[i]: the i-th character in s1 */
-	int cend = cbeg + cols;
-	int clast = 0;			/* the last non-blank column */
 	int att_old = 0;
+	int i = cbeg, j, k;
+	while (i < cend) {
+		int o = off[i - cbeg];
+		int att_new = o >= 0 ? att[o] : att_blank;
+		char *tr;
+		if (i > clast || o < 0) {	/* blanks after clast have the attribute of the last cell */
+			if (i <= clast)
+				att_old = att_new;
+			term_cell(i - cbeg, " ", 1, att_old);
+			i++;
+			continue;
+		}
+		att_old = att_new;
+		for (j = i; j < cend && off[j - cbeg] == o; j++)
+			;
+		tr = ren_translate(chrs[o], shp ? shp[o] : 0);
+		if (tr) {
+			term_cell(i - cbeg, tr, j - i, att_new);
+		} else if (uc_isprint(chrs[o])) {
+			char chr[8];
+			memcpy(chr, chrs[o], uc_len(chrs[o]));
+			chr[uc_len(chrs[o])] = '\0';
+			term_cell(i - cbeg, chr, j - i, att_new);
+		} else {
+			int cw = 0;
+			if (chrs[o][0] == '\t' && mapch_get("\t", NULL))
+				term_cell(i - cbeg, mapch_get("\t", &cw), cw, att_new);
+			for (k = i + cw; k < j; k++)
+				term_cell(k - cbeg, " ", 1, att_new);
+		}
+		i = j;
+	}
+}
+
+/* write the characters to the terminal; if old is given, write only the changed part */
+static void led_term(char **chrs, int *off, int *att, int *shp, int row,
+		int cbeg, int cend, int clast, int att_blank, char **old)
+{
 	struct sbuf out = {0};
-	int n, i, j;
-	int ctx = dir_context(s0);
-	int att_blank = 0;		/* the attribute of blank space */
+	int att_old = 0;
 	int out_col = 0;		/* draw starting at this column */
 	int out_off = old && *old ? -1 : 0;
 	int out_att = 0;
 	int old_len = old && *old ? strlen(*old) : 0;
-	chrs = uc_chop(s0, &n);
-	pos = ren_position(s0, n);
-	off = malloc((cend - cbeg) * sizeof(off[0]));
-	memset(off, 0xff, (cend - cbeg) * sizeof(off[0]));
-	/* initialise off[] using pos[] */
-	for (i = 0; i < n; i++) {
-		int curwid = ren_cwid(chrs[i], pos[i]);
-		int curbeg = led_pos(ctx, pos[i], cbeg, cend);
-		int curend = led_pos(ctx, pos[i] + curwid - 1, cbeg, cend);
-		if (curbeg >= 0 && curbeg < (cend - cbeg) &&
-				curend >= 0 && curend < (cend - cbeg)) {
-			for (j = 0; j < curwid; j++)
-				off[led_pos(ctx, pos[i] + j, cbeg, cend)] = i;
-		}
-	}
-	att = syn_highlight(n <= xlim ? syn : "", s0);
-	/* find the last non-empty column */
-	for (i = cbeg; i < cend; i++)
-		if (off[i - cbeg] >= 0)
-			clast = i;
-	/* the attribute of the last character is used for blanks */
-	att_blank = n > 0 ? att[n - 1] : 0;
-	led_markrev(n, chrs, pos, att);
+	int i, j;
 	/* generate term output */
 	sbuf_str(&out, xvte ? "\33[8l" : "");	/* disable BiDi in vte-based terminals */
 	i = cbeg;
@@ -90,8 +99,9 @@ void led_print(char *s0, int row, int cbeg, int cols, char *syn, char **old)
 		sbuf_str(&out, term_seqattr(att_new, att_old));
 		att_old = att_new;
 		if (o >= 0) {
-			if (ren_translate(chrs[o], s0)) {
-				sbuf_str(&out, ren_translate(chrs[o], s0));
+			char *tr = ren_translate(chrs[o], shp ? shp[o] : 0);
+			if (tr) {
+				sbuf_str(&out, tr);
 			} else if (uc_isprint(chrs[o])) {
 				sbuf_mem(&out, chrs[o], uc_len(chrs[o]));
 			} else {
@@ -133,10 +143,116 @@ void led_print(char *s0, int row, int cbeg, int cols, char *syn, char **old)
 	} else {
 		sbuf_free(&out);
 	}
+}
+
+/* does s have more than xlim characters */
+static int led_long(char *s)
+{
+	int n = 0;
+	while (*s && n <= xlim) {
+		s += uc_len(s);
+		n++;
+	}
+	return n > xlim;
+}
+
+/* print the characters of s1, whose screen positions are given in pos */
+static void led_draw(char *s1, char **chrs, int n, int *pos, int ctx, int flg,
+		int row, int cbeg, int cols, char *syn, char **old)
+{
+	int *off;	/* off[i]: the character at screen position i */
+	int *att;	/* att[i]: the attributes of i-th character */
+	int *shp;	/* shp[i]: the shaped form of the i-th character */
+	int cend = cbeg + cols;
+	int clast = 0;			/* the last non-blank column */
+	int att_blank = 0;		/* the attribute of blank space */
+	int i, j;
+	off = malloc((cend - cbeg) * sizeof(off[0]));
+	memset(off, 0xff, (cend - cbeg) * sizeof(off[0]));
+	/* initialise off[] using pos[] */
+	for (i = 0; i < n; i++) {
+		int curwid = ren_cwid(chrs[i], pos[i]);
+		int curbeg = led_pos(ctx, pos[i], cbeg, cend);
+		int curend = led_pos(ctx, pos[i] + curwid - 1, cbeg, cend);
+		if (curbeg >= 0 && curbeg < (cend - cbeg) &&
+				curend >= 0 && curend < (cend - cbeg)) {
+			for (j = 0; j < curwid; j++)
+				off[led_pos(ctx, pos[i] + j, cbeg, cend)] = i;
+		}
+	}
+	att = syn_highlight(syn, s1, flg);
+	shp = xshape ? uc_shape(chrs, n) : NULL;
+	/* find the last non-empty column */
+	for (i = cbeg; i < cend; i++)
+		if (off[i - cbeg] >= 0)
+			clast = i;
+	/* the attribute of the last character is used for blanks */
+	att_blank = n > 0 ? att[n - 1] : 0;
+	led_markrev(n, chrs, pos, att);
+	if (!term_grid(row)) {
+		led_cells(chrs, off, att, shp, cbeg, cend, clast, att_blank);
+		if (old)
+			led_reset(old);
+	} else {
+		led_term(chrs, off, att, shp, row, cbeg, cend, clast, att_blank, old);
+	}
+	free(shp);
 	free(att);
-	free(pos);
 	free(off);
+}
+
+/*
+ * Print s, a part of a long line whose first character is at column
+ * cpos; ctx is the direction context of the line and flg tells if s
+ * is preceded (RE_NOTBOL) or followed (RE_NOTEOL) by other characters.
+ */
+void led_printpart(char *s, int cpos, int ctx, int flg, int row, int cbeg, int cols, char *syn, char **old)
+{
+	char **chrs;	/* chrs[i]: the i-th character in s */
+	int *pos;	/* pos[i]: the screen position of the i-th character */
+	int n, i;
+	PROF_BEG(PROF_LED);
+	chrs = uc_chop(s, &n);
+	pos = malloc((n + 1) * sizeof(pos[0]));
+	for (i = 0; i < n; i++) {
+		pos[i] = cpos;
+		cpos += ren_cwid(chrs[i], cpos);
+	}
+	pos[n] = cpos;
+	led_draw(s, chrs, n, pos, ctx, flg, row, cbeg, cols, syn, old);
+	free(pos);
 	free(chrs);
+	PROF_END(PROF_LED, n);
+}
+
+/* render and print a line */
+void led_print(char *s0, int row, int cbeg, int cols, char *syn, char **old)
+{
+	char **chrs;
+	int *pos;
+	int n, i;
+	if (led_long(s0)) {
+		/* long lines are not reordered; render only the visible part and a margin */
+		struct sbuf win = {0};
+		int cpos, ctx;
+		char *beg = ren_span(s0, MAX(0, cbeg - cols), &cpos, &ctx);
+		char *end = beg;
+		for (i = cpos; *end && i < cbeg + cols * 2; end += uc_len(end))
+			i += ren_cwid(end, i);
+		sbuf_mem(&win, beg, end - beg);
+		led_printpart(sbuf_buf(&win), cpos, ctx,
+			(beg > s0 ? RE_NOTBOL : 0) | (*end ? RE_NOTEOL : 0),
+			row, cbeg, cols, syn, old);
+		sbuf_free(&win);
+		return;
+	}
+	PROF_BEG(PROF_LED);
+	chrs = uc_chop(s0, &n);
+	pos = ren_position(s0, n);
+	led_draw(s0, chrs, n, pos, dir_context(s0), 0, row, cbeg, cols, syn, old);
+	free(pos);
+	free(chrs);
+	PROF_END(PROF_LED, n);
 }
 
 void led_reset(char **old)
@@ -258,6 +374,12 @@ static char *led_line(char *pref, char *post, int *left, int *key, int *kmap, ch
 			led_match(cmp, sizeof(cmp), sbuf_buf(&sb), hist);
 		led_printparts(pref, sbuf_buf(&sb), post, left, *kmap, syn, &led_old);
 		c = term_read(0);
+		if (c == TK_ESC && (cs = term_paste()) != NULL) {
+			/* insert the first line of pasted text */
+			sbuf_mem(&sb, cs, strchr(cs, '\n') ? strchr(cs, '\n') - cs : strlen(cs));
+			free(cs);
+			continue;
+		}
 		switch (c) {
 		case TK_CTL('f'):
 			*kmap = xkmap_alt;
@@ -1,7 +1,9 @@
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,11 +15,14 @@
 #include "json.h"
 #include "vi.h"
 
+extern char **environ;
+
 static int lsp_pid;		/* LSP server PID */
 static int lsp_ifd;		/* LSP server standard input */
 static int lsp_ofd;		/* LSP server standard output */
 static int lsp_idx;		/* LSP command index */
 static struct sbuf lsp_res;	/* LSP server input stream */
+static int lsp_eof;		/* LSP server output is closed */
 static char lsp_root[1024];	/* project root (CWD) */
 static char lsp_file[1024];	/* the open file */
 static long lsp_mtime;		/* the modification time of lsp_file */
@@ -26,6 +31,7 @@ static int lsp_version;		/* lsp_file version */
 static char *http_request(long sz, char *fmt, ...);
 static int http_notify(long sz, char *fmt, ...);
 static long http_hlen(char *buf, long len);
+static void lsp_recv(int fd, int revents, void *dat);
 
 static int lsp_initialize(void)
 {
@@ -52,6 +58,8 @@ static void fds_close(int fds[2])
 
 int lsp_init(char *cmd[])
 {
+	posix_spawn_file_actions_t fa;
+	char *log = getenv("LSPLOG");
 	int ifds[2], ofds[2];
 	lsp_done();
 	strcpy(lsp_root, "file://");
@@ -62,30 +70,35 @@ int lsp_init(char *cmd[])
 		fds_close(ifds);
 		return 1;
 	}
-	lsp_pid = fork();
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, ifds[0], 0);
+	posix_spawn_file_actions_adddup2(&fa, ofds[1], 1);
+	posix_spawn_file_actions_addclose(&fa, ifds[0]);
+	posix_spawn_file_actions_addclose(&fa, ifds[1]);
+	posix_spawn_file_actions_addclose(&fa, ofds[0]);
+	posix_spawn_file_actions_addclose(&fa, ofds[1]);
+	posix_spawn_file_actions_addopen(&fa, 2, log ? log : "/dev/null",
+		O_WRONLY | O_TRUNC | O_CREAT, 0600);
+	if (posix_spawnp(&lsp_pid, cmd[0], &fa, NULL, cmd, environ))
+		lsp_pid = -1;
+	posix_spawn_file_actions_destroy(&fa);
 	if (lsp_pid < 0) {
+		lsp_pid = 0;
 		fds_close(ifds);
 		fds_close(ofds);
 		return 1;
 	}
-	if (!lsp_pid) {
-		char *log = getenv("LSPLOG");
-		dup2(ifds[0], 0);
-		dup2(ofds[1], 1);
-		fds_close(ifds);
-		fds_close(ofds);
-		close(2);
-		open(log ? log : "/dev/null", O_WRONLY | O_TRUNC | O_CREAT, 0600);
-		execvp(cmd[0], cmd);
-		exit(1);
-	}
 	lsp_ifd = ifds[1];
 	lsp_ofd = ofds[0];
 	lsp_idx = 0;
 	close(ifds[0]);
 	close(ofds[1]);
-	fcntl(lsp_ifd, F_SETFL, fcntl(lsp_ifd, F_GETFL, 0) | O_NONBLOCK | FD_CLOEXEC);
-	fcntl(lsp_ofd, F_SETFL, fcntl(lsp_ofd, F_GETFL, 0) | O_NONBLOCK | FD_CLOEXEC);
+	fcntl(lsp_ifd, F_SETFL, fcntl(lsp_ifd, F_GETFL, 0) | O_NONBLOCK);
+	fcntl(lsp_ofd, F_SETFL, fcntl(lsp_ofd, F_GETFL, 0) | O_NONBLOCK);
+	fcntl(lsp_ifd, F_SETFD, FD_CLOEXEC);
+	fcntl(lsp_ofd, F_SETFD, FD_CLOEXEC);
+	lsp_eof = 0;
+	ev_add(lsp_ofd, POLLIN, lsp_recv, NULL);
 	if (lsp_initialize()) {
 		lsp_done();
 		return 1;
@@ -348,8 +361,10 @@ void lsp_done(void)
 	http_notify(128, "{\"jsonrpc\": \"2.0\", \"method\": \"exit\"}");
 	if (lsp_ifd)
 		close(lsp_ifd);
-	if (lsp_ofd)
+	if (lsp_ofd) {
+		ev_del(lsp_ofd);
 		close(lsp_ofd);
+	}
 	for (i = 0; i < 5; i++) {
 		struct timespec ts = {.tv_sec = 0, .tv_nsec = i ? 200000000 : 5000000};
 		kill(lsp_pid, i < 4 ? SIGTERM : SIGKILL);
@@ -378,11 +393,11 @@ static long http_hlen(char *buf, long len)
 	char *r;
 	while (pos + 4 <= len && (r = memchr(buf + pos, '\n', len - pos)) != NULL) {
 		int cur = r - buf;
-		if (cur == 0 || cur + 3 > len)
-			continue;
-		if (buf[cur + 1] == '\r' && buf[cur + 2] == '\n')
+		if (cur + 3 > len)
+			break;
+		if (cur > 0 && buf[cur + 1] == '\r' && buf[cur + 2] == '\n')
 			return cur + 3;
-		pos++;
+		pos = cur + 1;
 	}
 	return -1;
 }
@@ -419,39 +434,41 @@ static long http_got(void)
 	return 0;
 }
 
-static int http_req(char *msg, long msg_sz)
+/* read LSP server output; called from the event loop */
+static void lsp_recv(int fd, int revents, void *dat)
 {
-	struct pollfd fds[2];
 	char buf[512];
+	long ret = read(fd, buf, sizeof(buf));
+	if (ret > 0)
+		sbuf_mem(&lsp_res, buf, ret);
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR)) {
+		ev_del(fd);
+		lsp_eof = 1;
+	}
+}
+
+static int http_req(char *msg, long msg_sz)
+{
+	struct pollfd fds[1];
 	long msg_nw = 0;
-	fds[0].fd = lsp_ofd;
-	fds[0].events = POLLIN;
-	fds[1].fd = msg ? lsp_ifd : -1;
-	fds[1].events = POLLOUT;
-	while ((fds[0].fd >= 0 || fds[1].fd >= 0) && poll(fds, 2, 200) >= 0) {
-		if (fds[0].revents & POLLIN) {
-			long ret = read(fds[0].fd, buf, sizeof(buf));
+	PROF_BEG(PROF_LSP);
+	fds[0].fd = msg ? lsp_ifd : -1;
+	fds[0].events = POLLOUT;
+	fds[0].revents = 0;
+	while (msg ? fds[0].fd >= 0 : !lsp_eof && !http_got()) {
+		if (ev_poll(fds, msg ? 1 : 0, 200) < 0)
+			break;
+		if (fds[0].revents & POLLOUT) {
+			long ret = write(fds[0].fd, msg + msg_nw, msg_sz - msg_nw);
 			if (ret > 0)
-				sbuf_mem(&lsp_res, buf, ret);
-			if (ret <= 0)
+				msg_nw += ret;
+			if (ret <= 0 || msg_nw == msg_sz)
 				fds[0].fd = -1;
 		} else if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
 			fds[0].fd = -1;
 		}
-		if (fds[1].revents & POLLOUT) {
-			long ret = write(fds[1].fd, msg + msg_nw, msg_sz - msg_nw);
-			if (ret > 0)
-				msg_nw += ret;
-			if (ret <= 0 || msg_nw == msg_sz)
-				fds[1].fd = -1;
-		} else if (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-			fds[1].fd = -1;
-		}
-		if (msg && msg_nw == msg_sz)
-			break;
-		if (!msg && http_got())
-			break;
 	}
+	PROF_END(PROF_LSP, msg_nw);
 	return 0;
 }
 
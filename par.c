@@ -0,0 +1,65 @@
+/* running loops over line ranges in parallel */
+#include <pthread.h>
+#include <unistd.h>
+#include "vi.h"
+
+#define PARTHREADS	16	/* maximum number of threads */
+
+struct par {
+	pthread_mutex_t lock;
+	int next;		/* the first unclaimed index */
+	int n;			/* the number of indices */
+	int chunk;		/* indices claimed at once */
+	void (*fn)(void *dat, int beg, int end);
+	void *dat;
+};
+
+static void *par_worker(void *v)
+{
+	struct par *p = v;
+	int beg;
+	while (1) {
+		pthread_mutex_lock(&p->lock);
+		beg = p->next;
+		p->next = MIN(p->n, beg + p->chunk);
+		pthread_mutex_unlock(&p->lock);
+		if (beg >= p->n)
+			break;
+		p->fn(p->dat, beg, MIN(p->n, beg + p->chunk));
+	}
+	return NULL;
+}
+
+/*
+ * Call fn for consecutive chunks of [0, n), in parallel if n exceeds
+ * chunk.  fn may be called concurrently and should only read shared
+ * state; it returns after all calls are finished.
+ */
+void par_for(int n, int chunk, void (*fn)(void *dat, int beg, int end), void *dat)
+{
+	pthread_t th[PARTHREADS];
+	struct par p;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int cnt = MIN(MIN(PARTHREADS, ncpu), (n + chunk - 1) / chunk);
+	int i, nth = 0;
+	if (cnt <= 1) {
+		if (n > 0)
+			fn(dat, 0, n);
+		return;
+	}
+	pthread_mutex_init(&p.lock, NULL);
+	p.next = 0;
+	p.n = n;
+	p.chunk = chunk;
+	p.fn = fn;
+	p.dat = dat;
+	prof_pause(1);
+	for (i = 1; i < cnt; i++)
+		if (!pthread_create(&th[nth], NULL, par_worker, &p))
+			nth++;
+	par_worker(&p);
+	for (i = 0; i < nth; i++)
+		pthread_join(th[i], NULL);
+	prof_pause(0);
+	pthread_mutex_destroy(&p.lock);
+}
@@ -0,0 +1,170 @@
+/* reading the next files of the argument list in the background */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vi.h"
+
+#define PREMEM		(64l << 20)	/* the memory of the files read ahead */
+
+static struct pre {
+	char *path;		/* the file; NULL if unused */
+	int prio;		/* files with lower prio are read first */
+	int busy;		/* being read */
+	int fail;		/* cannot be read */
+	struct lbuf *lb;	/* its contents, once read */
+	long mtime;		/* its modification time when read */
+} pre[PRECNT];
+
+static pthread_t pre_th;
+static pthread_mutex_t pre_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pre_cond = PTHREAD_COND_INITIALIZER;
+static int pre_started;		/* the thread is running */
+static int pre_quit;		/* the thread should exit */
+static long pre_mem;		/* the memory of the files read */
+
+static long pre_mtime(char *path)
+{
+	struct stat st;
+	if (!stat(path, &st))
+		return st.st_mtime;
+	return -1;
+}
+
+/* the unused slot of pre[] with the lowest prio */
+static struct pre *pre_next(void)
+{
+	struct pre *p = NULL;
+	int i;
+	for (i = 0; i < PRECNT; i++)
+		if (pre[i].path && !pre[i].lb && !pre[i].busy && !pre[i].fail)
+			if (!p || pre[i].prio < p->prio)
+				p = &pre[i];
+	return p;
+}
+
+static void *pre_worker(void *v)
+{
+	pthread_mutex_lock(&pre_lock);
+	while (!pre_quit) {
+		struct pre *p = pre_next();
+		struct lbuf *lb;
+		char *path;
+		long mtime;
+		int fd;
+		if (!p || pre_mem >= PREMEM) {
+			pthread_cond_wait(&pre_cond, &pre_lock);
+			continue;
+		}
+		path = uc_dup(p->path);
+		p->busy = 1;
+		pthread_mutex_unlock(&pre_lock);
+		lb = NULL;
+		mtime = pre_mtime(path);
+		if ((fd = open(path, O_RDONLY)) >= 0) {
+			lb = lbuf_make();
+			if (lbuf_rd(lb, fd, 0, 0)) {
+				lbuf_free(lb);
+				lb = NULL;
+			}
+			close(fd);
+		}
+		pthread_mutex_lock(&pre_lock);
+		p->busy = 0;
+		if (p->path && !strcmp(p->path, path)) {
+			p->lb = lb;
+			p->mtime = mtime;
+			p->fail = !lb;
+			if (lb)
+				pre_mem += lbuf_size(lb);
+		} else if (lb) {
+			lbuf_free(lb);
+		}
+		free(path);
+		pthread_cond_broadcast(&pre_cond);
+	}
+	pthread_mutex_unlock(&pre_lock);
+	return NULL;
+}
+
+static void pre_drop(struct pre *p)
+{
+	if (p->lb) {
+		pre_mem -= lbuf_size(p->lb);
+		lbuf_free(p->lb);
+	}
+	free(p->path);
+	p->path = NULL;
+	p->lb = NULL;
+	p->fail = 0;
+}
+
+/* read the given files in the background, the first ones first */
+void pre_fetch(char **paths, int n)
+{
+	int i, j;
+	pthread_mutex_lock(&pre_lock);
+	for (i = 0; i < PRECNT; i++) {
+		pre[i].prio = PRECNT;
+		for (j = 0; pre[i].path && j < n; j++)
+			if (!strcmp(pre[i].path, paths[j]))
+				pre[i].prio = j;
+		if (pre[i].path && pre[i].prio == PRECNT)
+			pre_drop(&pre[i]);
+	}
+	for (j = 0; j < n && j < PRECNT; j++) {
+		for (i = 0; i < PRECNT; i++)
+			if (pre[i].path && !strcmp(pre[i].path, paths[j]))
+				break;
+		if (i < PRECNT)
+			continue;
+		for (i = 0; i < PRECNT && pre[i].path; i++)
+			;
+		pre[i].path = uc_dup(paths[j]);
+		pre[i].prio = j;
+	}
+	if (!pre_started && n > 0)
+		pre_started = !pthread_create(&pre_th, NULL, pre_worker, NULL);
+	pthread_cond_broadcast(&pre_cond);
+	pthread_mutex_unlock(&pre_lock);
+}
+
+/* the contents of path, if read in the background and not changed since */
+struct lbuf *pre_take(char *path)
+{
+	struct lbuf *lb = NULL;
+	int i;
+	pthread_mutex_lock(&pre_lock);
+	for (i = 0; i < PRECNT; i++)
+		if (pre[i].path && !strcmp(pre[i].path, path))
+			break;
+	while (i < PRECNT && pre[i].busy)
+		pthread_cond_wait(&pre_cond, &pre_lock);
+	if (i < PRECNT) {
+		if (pre[i].lb && pre[i].mtime == pre_mtime(path)) {
+			pre_mem -= lbuf_size(pre[i].lb);
+			lb = pre[i].lb;
+			pre[i].lb = NULL;
+		}
+		pre_drop(&pre[i]);
+	}
+	pthread_mutex_unlock(&pre_lock);
+	return lb;
+}
+
+void pre_done(void)
+{
+	int i;
+	if (pre_started) {
+		pthread_mutex_lock(&pre_lock);
+		pre_quit = 1;
+		pthread_cond_broadcast(&pre_cond);
+		pthread_mutex_unlock(&pre_lock);
+		pthread_join(pre_th, NULL);
+		pre_started = 0;
+	}
+	for (i = 0; i < PRECNT; i++)
+		pre_drop(&pre[i]);
+}
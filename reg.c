@@ -4,14 +4,96 @@
 #include <string.h>
 #include "vi.h"
 
-static char *bufs[256];
-static int lnmode[256];
+/* reference-counted text, shared between registers; only unshared
+ * text is modified, when appending to it */
+struct rtxt {
+	int ref;		/* number of references */
+	long len;		/* the length of s */
+	long sz;		/* the size of s[] */
+	char s[1];
+};
 
+/* a register: the concatenation of its chunks */
+static struct reg {
+	struct rtxt **txt;	/* chunks */
+	int n;			/* number of chunks */
+	int sz;			/* size of txt[] */
+	int ln;			/* line mode */
+} regs[256];
+
+static struct rtxt *rtxt_make(char *s, long len)
+{
+	struct rtxt *t = malloc(sizeof(*t) + len);
+	t->ref = 1;
+	t->len = len;
+	t->sz = len + 1;
+	memcpy(t->s, s, len);
+	t->s[len] = '\0';
+	return t;
+}
+
+static void rtxt_put(struct rtxt *t)
+{
+	if (t && !--t->ref)
+		free(t);
+}
+
+static void reg_clear(struct reg *r)
+{
+	int i;
+	for (i = 0; i < r->n; i++)
+		rtxt_put(r->txt[i]);
+	free(r->txt);
+	memset(r, 0, sizeof(*r));
+}
+
+/* append a reference to t to r */
+static void reg_add(struct reg *r, struct rtxt *t)
+{
+	if (r->n == r->sz) {
+		int sz = r->sz + (r->sz ? r->sz : 4);
+		struct rtxt **txt = malloc(sz * sizeof(txt[0]));
+		if (r->n)
+			memcpy(txt, r->txt, r->n * sizeof(txt[0]));
+		free(r->txt);
+		r->txt = txt;
+		r->sz = sz;
+	}
+	t->ref++;
+	r->txt[r->n++] = t;
+}
+
+/* the contents of register c; its chunks are joined when read */
 static char *reg_getraw(int c, int *ln)
 {
+	struct reg *r = &regs[c];
 	if (ln != NULL)
-		*ln = lnmode[c];
-	return bufs[c];
+		*ln = r->ln;
+	if (r->n > 1) {
+		struct rtxt *t = r->txt[0];
+		long len = 0;
+		int i;
+		for (i = 0; i < r->n; i++)
+			len += r->txt[i]->len;
+		/* the joined text is extended in place by later joins */
+		if (t->ref > 1 || t->sz <= len) {
+			struct rtxt *j = malloc(sizeof(*j) + len * 2);
+			j->ref = 1;
+			j->len = t->len;
+			j->sz = len * 2 + 1;
+			memcpy(j->s, t->s, t->len);
+			rtxt_put(t);
+			r->txt[0] = t = j;
+		}
+		for (i = 1; i < r->n; i++) {
+			memcpy(t->s + t->len, r->txt[i]->s, r->txt[i]->len);
+			t->len += r->txt[i]->len;
+			rtxt_put(r->txt[i]);
+		}
+		t->s[t->len] = '\0';
+		r->n = 1;
+	}
+	return r->n ? r->txt[0]->s : NULL;
 }
 
 char *reg_get(int c, int *lnmode)
@@ -47,33 +129,41 @@ char *reg_get(int c, int *lnmode)
 	return reg_getraw(c, lnmode);
 }
 
-static void reg_putraw(int c, char *s, int ln)
+/* store t in register c; uppercase letters append to the register */
+static void reg_putraw(int c, struct rtxt *t, int ln)
 {
-	char *pre = isupper(c) && bufs[tolower(c)] ? bufs[tolower(c)] : "";
-	char *buf = malloc(strlen(pre) + strlen(s) + 1);
-	strcpy(buf, pre);
-	strcat(buf, s);
-	free(bufs[tolower(c)]);
-	bufs[tolower(c)] = buf;
-	lnmode[tolower(c)] = ln;
+	struct reg *r = &regs[tolower(c)];
+	if (!isupper(c))
+		reg_clear(r);
+	reg_add(r, t);
+	r->ln = ln;
 }
 
 void reg_put(int c, char *s, int ln)
 {
-	int i, i_ln;
-	char *i_s;
+	struct rtxt *t = rtxt_make(s, strlen(s));
 	if ((ln || strchr(s, '\n')) && (!c || isalpha(c))) {
-		for (i = 8; i > 0; i--)
-			if ((i_s = reg_get('0' + i, &i_ln)))
-				reg_putraw('0' + i + 1, i_s, i_ln);
-		reg_putraw('1', s, ln);
+		/* rotate numbered registers without copying their text */
+		reg_clear(&regs['9']);
+		memmove(&regs['2'], &regs['1'], 8 * sizeof(regs[0]));
+		memset(&regs['1'], 0, sizeof(regs[0]));
+		reg_putraw('1', t, ln);
 	}
-	reg_putraw(c, s, ln);
+	reg_putraw(c, t, ln);
+	rtxt_put(t);
+}
+
+/* append s to register c, without shifting numbered registers */
+void reg_append(int c, char *s)
+{
+	struct rtxt *t = rtxt_make(s, strlen(s));
+	reg_add(&regs[c], t);
+	rtxt_put(t);
 }
 
 void reg_done(void)
 {
 	int i;
-	for (i = 0; i < LEN(bufs); i++)
-		free(bufs[i]);
+	for (i = 0; i < LEN(regs); i++)
+		reg_clear(&regs[i]);
 }
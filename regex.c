@@ -60,6 +60,7 @@ struct rstate_mark {
 struct rstate {
 	char *s;			/* the current position in the string */
 	char *o;			/* the beginning of the string */
+	char *e;			/* the end of the string, if not NUL-terminated */
 	int pc;				/* program counter */
 	int flg;			/* flags passed to regcomp() and regexec() */
 	int subcnt;			/* number of groups to return */
@@ -76,6 +77,7 @@ static void rstate_init(struct rstate *rs, char *s, int flg, int subcnt)
 {
 	rs->o = s;
 	rs->s = s;
+	rs->e = NULL;
 	rs->flg = flg;
 	rs->mark = rs->_mark;
 	rs->mark_pos = 0;
@@ -365,12 +367,18 @@ static int brk_match(char *brk, int c, int flg)
 	return !not;
 }
 
+/* is s at the end of the string */
+static int rs_end(struct rstate *rs, char *s)
+{
+	return !*s || s == rs->e;
+}
+
 static int ratom_match(struct ratom *ra, struct rstate *rs)
 {
 	if (ra->ra == RA_CHR && !(rs->flg & REG_ICASE)) {
 		char *s = ra->s;
 		char *r = rs->s;
-		while (*s && *s == *r)
+		while (*s && r != rs->e && *s == *r)
 			s++, r++;
 		if (*s)
 			return 1;
@@ -381,7 +389,7 @@ static int ratom_match(struct ratom *ra, struct rstate *rs)
 		int pos = 0;
 		while (ra->s[pos]) {
 			int c1 = uc_dec(ra->s + pos);
-			int c2 = uc_dec(rs->s + pos);
+			int c2 = rs_end(rs, rs->s + pos) ? 0 : uc_dec(rs->s + pos);
 			if (rs->flg & REG_ICASE && c1 < 128 && isupper(c1))
 				c1 = tolower(c1);
 			if (rs->flg & REG_ICASE && c2 < 128 && isupper(c2))
@@ -394,13 +402,13 @@ static int ratom_match(struct ratom *ra, struct rstate *rs)
 		return 0;
 	}
 	if (ra->ra == RA_ANY) {
-		if (!rs->s[0] || (rs->s[0] == '\n' && !!(rs->flg & REG_NEWLINE)))
+		if (rs_end(rs, rs->s) || (rs->s[0] == '\n' && !!(rs->flg & REG_NEWLINE)))
 			return 1;
 		rs->s += uc_len(rs->s);
 		return 0;
 	}
 	if (ra->ra == RA_BRK) {
-		int c = uc_dec(rs->s);
+		int c = rs_end(rs, rs->s) ? 0 : uc_dec(rs->s);
 		if (!c || (c == '\n' && !!(rs->flg & REG_NEWLINE) && ra->s[1] == '^'))
 			return 1;
 		rs->s += uc_len(rs->s);
@@ -410,16 +418,16 @@ static int ratom_match(struct ratom *ra, struct rstate *rs)
 		return !!(rs->flg & REG_NOTBOL);
 	if (ra->ra == RA_BEG && rs->s > rs->o && rs->s[-1] == '\n')
 		return !(rs->flg & REG_NEWLINE);
-	if (ra->ra == RA_END && rs->s[0] == '\0')
+	if (ra->ra == RA_END && rs_end(rs, rs->s))
 		return !!(rs->flg & REG_NOTEOL);
 	if (ra->ra == RA_END && rs->s[0] == '\n')
 		return !(rs->flg & REG_NEWLINE);
 	if (ra->ra == RA_WBEG)
 		return !((rs->s == rs->o || !isword(uc_beg(rs->o, rs->s - 1))) &&
-			isword(rs->s));
+			!rs_end(rs, rs->s) && isword(rs->s));
 	if (ra->ra == RA_WEND)
 		return !(rs->s != rs->o && isword(uc_beg(rs->o, rs->s - 1)) &&
-			(!rs->s[0] || !isword(rs->s)));
+			(rs_end(rs, rs->s) || !isword(rs->s)));
 	return 1;
 }
 
@@ -700,23 +708,35 @@ static int re_recmatch(struct regex *re, struct rstate *rs)
 	return 1;
 }
 
+/* with REG_STARTEND, only s[psub[0].rm_so, psub[0].rm_eo) is searched */
 int regexec(regex_t *preg, char *s, int nsub, regmatch_t psub[], int flg)
 {
 	struct regex *re = *preg;
 	struct rstate rs;
-	char *o = s;
+	long beg = flg & REG_STARTEND ? psub[0].rm_so : 0;
+	char *e = flg & REG_STARTEND ? s + psub[0].rm_eo : NULL;
+	char *o;
 	int i;
+	s += beg;
+	o = s;
 	rstate_init(&rs, s, re->flg | flg, flg & REG_NOSUB ? 0 : nsub);
+	rs.e = e;
 	for (i = 0; i < nsub; i++) {
 		psub[i].rm_so = -1;
 		psub[i].rm_eo = -1;
 	}
-	while (*o && !((flg & REG_EOLSTOP) && o != rs.o && *o == '\n')) {
+	while (!rs_end(&rs, o) && !((flg & REG_EOLSTOP) && o != rs.o && *o == '\n')) {
 		rs.s = o = s;
 		s += uc_len(s);
 		if (!re_recmatch(re, &rs)) {
 			rstate_marks(&rs, psub);
 			rstate_done(&rs);
+			for (i = 0; beg && i < nsub; i++) {
+				if (psub[i].rm_so >= 0)
+					psub[i].rm_so += beg;
+				if (psub[i].rm_eo >= 0)
+					psub[i].rm_eo += beg;
+			}
 			return 0;
 		}
 	}
@@ -5,6 +5,7 @@
 #define REG_NOTBOL		0x10
 #define REG_NOTEOL		0x20
 #define REG_EOLSTOP		0x40
+#define REG_STARTEND		0x80
 
 typedef struct {
 	long rm_so;
@@ -36,14 +36,19 @@ int *ren_position(char *s, int n)
 	int cpos = 0;
 	int *pos;
 	int i;
-	if (n <= xlim && (xorder == 2 || (xorder == 1 && (n < strlen(s) || dir_context(s) < 0))))
-		return ren_position_reorder(s, n);
+	PROF_BEG(PROF_REN);
+	if (n <= xlim && (xorder == 2 || (xorder == 1 && (n < strlen(s) || dir_context(s) < 0)))) {
+		pos = ren_position_reorder(s, n);
+		PROF_END(PROF_REN, n);
+		return pos;
+	}
 	pos = malloc((n + 1) * sizeof(pos[0]));
 	for (i = 0; i < n; i++, s += uc_len(s)) {
 		pos[i] = cpos;
 		cpos += ren_cwid(s, cpos);
 	}
 	pos[i] = cpos;
+	PROF_END(PROF_REN, n);
 	return pos;
 }
 
@@ -177,8 +182,90 @@ int ren_cwid(char *s, int pos)
 	return uc_wid(s);
 }
 
-char *ren_translate(char *s, char *ln)
+/* the text to draw for character s; shape is its shaped form (see uc_shape()) or zero */
+char *ren_translate(char *s, int shape)
 {
+	static char buf[8];
 	char *p = s[0] != '\t' ? mapch_get(s, NULL) : NULL;
-	return p || !xshape ? p : uc_shape(ln, s);
+	if (p || !shape)
+		return p;
+	uc_cput(buf, shape);
+	return buf;
+}
+
+#define RCKLEN		256	/* characters between checkpoints */
+
+/* column checkpoints of recently drawn long lines */
+static struct rline {
+	char *s;	/* a copy of the line */
+	long len;
+	int ts;
+	int td;		/* text direction */
+	int ctx;	/* direction context */
+	int *ck;	/* ck[2i]: the offset of character i * RCKLEN; ck[2i + 1]: its position */
+	int ck_n;
+} rlines[2];
+static int rlines_cur;
+
+static struct rline *ren_line(char *s)
+{
+	long len = strlen(s);
+	struct rline *rl;
+	char *r;
+	int cpos = 0;
+	int i;
+	for (i = 0; i < LEN(rlines); i++) {
+		rl = &rlines[i];
+		if (rl->s && rl->len == len && rl->ts == xts && rl->td == xtd && !memcmp(rl->s, s, len))
+			return rl;
+	}
+	rl = &rlines[rlines_cur];
+	rlines_cur = (rlines_cur + 1) % LEN(rlines);
+	free(rl->s);
+	free(rl->ck);
+	rl->s = malloc(len + 1);
+	memcpy(rl->s, s, len + 1);
+	rl->len = len;
+	rl->ts = xts;
+	rl->td = xtd;
+	rl->ck = malloc((len / RCKLEN + 1) * 2 * sizeof(rl->ck[0]));
+	rl->ck_n = 0;
+	for (i = 0, r = s; *r; i++, r += uc_len(r)) {
+		if (i % RCKLEN == 0) {
+			rl->ck[rl->ck_n * 2 + 0] = r - s;
+			rl->ck[rl->ck_n * 2 + 1] = cpos;
+			rl->ck_n++;
+		}
+		cpos += ren_cwid(r, cpos);
+	}
+	rl->ctx = dir_context(s);
+	return rl;
+}
+
+/* the first character of long line s that ends after column col; its position is stored in pos */
+char *ren_span(char *s, int col, int *pos, int *ctx)
+{
+	struct rline *rl = ren_line(s);
+	int l = 0;
+	int h = rl->ck_n - 1;
+	int cpos = 0;
+	char *r = s;
+	while (l < h) {
+		int m = (l + h + 1) / 2;
+		if (rl->ck[m * 2 + 1] <= col)
+			l = m;
+		else
+			h = m - 1;
+	}
+	if (rl->ck_n > 0) {
+		r = s + rl->ck[l * 2];
+		cpos = rl->ck[l * 2 + 1];
+	}
+	while (*r && cpos + ren_cwid(r, cpos) <= col) {
+		cpos += ren_cwid(r, cpos);
+		r += uc_len(r);
+	}
+	*pos = cpos;
+	*ctx = rl->ctx;
+	return r;
 }
@@ -86,7 +86,8 @@ struct rset *rset_make(int n, char **re, int flg)
 	return rs;
 }
 
-/* return the index of the matching regular expression or -1 if none matches */
+/* return the index of the matching regular expression or -1 if none matches;
+ * with RE_STARTEND, only s[grps[0], grps[1]) is searched */
 int rset_find(struct rset *rs, char *s, int n, int *grps, int flg)
 {
 	regmatch_t *subs;
@@ -94,12 +95,20 @@ int rset_find(struct rset *rs, char *s, int n, int *grps, int flg)
 	int regex_flg = REG_NEWLINE | REG_EOLSTOP;
 	if (rs->grpcnt <= 2)
 		return -1;
+	PROF_BEG(PROF_RSET);
 	if (flg & RE_NOTBOL)
 		regex_flg |= REG_NOTBOL;
 	if (flg & RE_NOTEOL)
 		regex_flg |= REG_NOTEOL;
 	subs = malloc(rs->grpcnt * sizeof(subs[0]));
+	if (flg & RE_STARTEND) {
+		regex_flg |= REG_STARTEND;
+		subs[0].rm_so = grps[0];
+		subs[0].rm_eo = grps[1];
+	}
+	PROF_BEG(PROF_REGEX);
 	found = !regexec(&rs->regex, s, rs->grpcnt, subs, regex_flg);
+	PROF_END(PROF_REGEX, 0);
 	for (i = 0; found && i < rs->n; i++)
 		if (rs->grp[i] >= 0 && subs[rs->grp[i]].rm_so >= 0)
 			set = i;
@@ -116,6 +125,7 @@ int rset_find(struct rset *rs, char *s, int n, int *grps, int flg)
 		}
 	}
 	free(subs);
+	PROF_END(PROF_RSET, 0);
 	return set;
 }
 
@@ -0,0 +1,242 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vi.h"
+
+#define LATBKT		32	/* histogram buckets; bucket i: [2^i, 2^(i+1)) microseconds */
+#define LATPEND		64	/* commands executed but not yet painted */
+#define LATFMT		"%-6s %6s  cmd %6s %6s  paint %6s %6s"
+
+/* latency histograms of a command */
+struct lat {
+	int cnt;		/* number of commands */
+	int cmd[LATBKT];	/* from input to the end of command */
+	int paint[LATBKT];	/* from input to screen update */
+};
+
+static struct lat lats[256];	/* per command key; zero for insert mode */
+static long lat_in;		/* when the last input was read */
+static long lat_beg;		/* when the first key of the command was read */
+static long pend_beg[LATPEND];	/* input time of unpainted commands */
+static int pend_cmd[LATPEND];	/* unpainted commands */
+static int pend_cnt;
+
+static long lat_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void lat_add(int *hist, long usec)
+{
+	int i = 0;
+	while (i < LATBKT - 1 && usec >= (2l << i))
+		i++;
+	hist[i]++;
+}
+
+/* input was read from the terminal */
+void lat_input(void)
+{
+	lat_in = lat_now();
+}
+
+/* a key was read; buffered keys were received with the last input */
+void lat_key(int buffered)
+{
+	if (!lat_beg)
+		lat_beg = buffered ? lat_in : lat_now();
+}
+
+/* the editor is waiting for a new command */
+void lat_wait(void)
+{
+	lat_beg = 0;
+}
+
+/* the command with the given key was executed */
+void lat_cmd(int cmd)
+{
+	if (!lat_beg || cmd < 0) {
+		lat_beg = 0;
+		return;
+	}
+	cmd = (unsigned char) cmd;
+	lats[cmd].cnt++;
+	lat_add(lats[cmd].cmd, lat_now() - lat_beg);
+	if (pend_cnt < LATPEND) {
+		pend_beg[pend_cnt] = lat_beg;
+		pend_cmd[pend_cnt] = cmd;
+		pend_cnt++;
+	}
+	lat_beg = 0;
+}
+
+/* the screen was updated */
+void lat_paint(void)
+{
+	long now;
+	int i;
+	if (!pend_cnt)
+		return;
+	now = lat_now();
+	for (i = 0; i < pend_cnt; i++)
+		lat_add(lats[pend_cmd[i]].paint, now - pend_beg[i]);
+	pend_cnt = 0;
+}
+
+/* the upper bound of the given percentile */
+static char *lat_pct(int *hist, int pct, char *buf)
+{
+	long usec;
+	int cnt = 0, sum = 0;
+	int i;
+	for (i = 0; i < LATBKT; i++)
+		cnt += hist[i];
+	if (!cnt)
+		return "-";
+	for (i = 0; i < LATBKT - 1; i++)
+		if ((sum += hist[i]) * 100 >= cnt * pct)
+			break;
+	usec = 2l << i;
+	if (usec >= 10000)
+		sprintf(buf, "%ldms", usec / 1000);
+	else
+		sprintf(buf, "%ldus", usec);
+	return buf;
+}
+
+static void lat_line(char *d, int cmd)
+{
+	struct lat *l = &lats[cmd];
+	char name[8], cnt[16];
+	char p1[16], p2[16], p3[16], p4[16];
+	if (cmd == 0)
+		strcpy(name, "insert");
+	else if (cmd < 0x20 || cmd == 0x7f)
+		sprintf(name, "^%c", cmd ^ 0x40);
+	else if (cmd >= 0x80)
+		sprintf(name, "\\x%02x", cmd);
+	else
+		sprintf(name, "%c", cmd);
+	sprintf(cnt, "%d", l->cnt);
+	sprintf(d, LATFMT, name, cnt,
+		lat_pct(l->cmd, 50, p1), lat_pct(l->cmd, 99, p2),
+		lat_pct(l->paint, 50, p3), lat_pct(l->paint, 99, p4));
+}
+
+/* print the latency of commands (50th and 99th percentiles) */
+void lat_show(void)
+{
+	char buf[128];
+	int i;
+	sprintf(buf, LATFMT, "key", "count", "p50", "p99", "p50", "p99");
+	ex_print(buf);
+	for (i = 0; i < LEN(lats); i++) {
+		if (lats[i].cnt) {
+			lat_line(buf, i);
+			ex_print(buf);
+		}
+	}
+}
+
+/* write the latency report to the file named in $VILAT, if set */
+void lat_done(void)
+{
+	char buf[128];
+	char *path = getenv("VILAT");
+	FILE *fp;
+	int i;
+	if (!path || !path[0] || !(fp = fopen(path, "a")))
+		return;
+	sprintf(buf, LATFMT, "key", "count", "p50", "p99", "p50", "p99");
+	fprintf(fp, "%s\n", buf);
+	for (i = 0; i < LEN(lats); i++) {
+		if (lats[i].cnt) {
+			lat_line(buf, i);
+			fprintf(fp, "%s\n", buf);
+		}
+	}
+	fclose(fp);
+}
+
+/* profiling counters */
+static long prof_calls[PROF_CNT];
+static long prof_nsec[PROF_CNT];
+static long prof_bytes[PROF_CNT];
+static long prof_t[PROF_CNT];	/* when the outermost call began */
+static int prof_dep[PROF_CNT];	/* nested calls */
+static int prof_off;		/* ignore calls, for instance from other threads */
+static pthread_t prof_th;	/* the counted thread: the first caller */
+static int prof_thset;
+
+static long prof_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000l + ts.tv_nsec;
+}
+
+/* calls from background threads are ignored */
+static int prof_ignored(void)
+{
+	if (prof_off)
+		return 1;
+	if (!prof_thset) {
+		prof_th = pthread_self();
+		prof_thset = 1;
+	}
+	return !pthread_equal(prof_th, pthread_self());
+}
+
+void prof_beg(int id)
+{
+	if (prof_ignored())
+		return;
+	if (!prof_dep[id]++)
+		prof_t[id] = prof_now();
+}
+
+void prof_end(int id, long bytes)
+{
+	if (prof_ignored())
+		return;
+	prof_calls[id]++;
+	prof_bytes[id] += bytes;
+	if (!--prof_dep[id])
+		prof_nsec[id] += prof_now() - prof_t[id];
+}
+
+/* suspend the counters while other threads run */
+void prof_pause(int on)
+{
+	prof_off = on;
+}
+
+/* print and reset profiling counters */
+void prof_show(void)
+{
+#ifdef PROF
+	static char *names[PROF_CNT] = {
+		"regexec", "rset_find", "syn_highlight", "ren_position", "dir_reorder",
+		"led_print", "lbuf_replace", "cmd_pipe", "http_req", "term_commit",
+	};
+	char buf[128];
+	int i;
+	sprintf(buf, "%-14s %10s %12s %12s", "", "calls", "msec", "bytes");
+	ex_print(buf);
+	for (i = 0; i < PROF_CNT; i++) {
+		sprintf(buf, "%-14s %10ld %12.3f %12ld", names[i],
+			prof_calls[i], prof_nsec[i] / 1000000.0, prof_bytes[i]);
+		ex_print(buf);
+	}
+	memset(prof_calls, 0, sizeof(prof_calls));
+	memset(prof_nsec, 0, sizeof(prof_nsec));
+	memset(prof_bytes, 0, sizeof(prof_bytes));
+#else
+	ex_print("profiling counters are not compiled in (PROF)");
+#endif
+}
@@ -60,20 +60,20 @@ void syn_context(int ctx1, int ctx2)
 	syn_ctx2 = conf_hl(ctx2);
 }
 
-int *syn_highlight(char *ft, char *s)
+int *syn_highlight(char *ft, char *s, int flg)
 {
 	int subs[16 * 2];
 	int n = uc_slen(s);
 	int *att = malloc(n * sizeof(att[0]));
 	int soff = 0;
 	struct rset *rs = syn_find(ft);
-	int flg = 0;
 	int hl, j, i;
 	if (!strcmp(ft, "___")) {
 		for (i = 0; i < n; i++)
 			att[i] = SYN_RV;
 		return att;
 	}
+	PROF_BEG(PROF_SYN);
 	for (i = 0; i < n; i++)
 		att[i] = syn_ctx1;
 	if (conf_hl('&')) {
@@ -90,8 +90,10 @@ int *syn_highlight(char *ft, char *s)
 	}
 	if (!rs)
 		rs = syn_make(ft);
-	if (!rs)
+	if (!rs) {
+		PROF_END(PROF_SYN, n);
 		return att;
+	}
 	while ((hl = rset_find(rs, s + soff, LEN(subs) / 2, subs, flg)) >= 0) {
 		int sidx = uc_off(s, soff);
 		int grp = 0;
@@ -111,8 +113,9 @@ int *syn_highlight(char *ft, char *s)
 			}
 		}
 		soff += cend;
-		flg = RE_NOTBOL;
+		flg |= RE_NOTBOL;
 	}
+	PROF_END(PROF_SYN, n);
 	return att;
 }
 
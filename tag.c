@@ -310,12 +310,13 @@ int qfix_next(void)
 	char *eol;
 	if (!qfix || !*qfix || qfix_pos >= (signed long) strlen(qfix))
 		return 1;
-	while ((eol = qfix_pos >= 0 ? strchr(qfix + qfix_pos, '\n') : qfix - 1)) {
+	/* stay on the last line; more lines may be appended by a job */
+	while ((eol = qfix_pos >= 0 ? strchr(qfix + qfix_pos, '\n') : qfix - 1) && eol[1]) {
 		qfix_pos = eol + 1 - qfix;
 		if (!qfix_readln(qfix + qfix_pos, NULL, 0, NULL, NULL, NULL, 0))
 			return 0;
 	}
-	return !eol || !eol[1];
+	return 1;
 }
 
 int qfix_prev(void)
@@ -1,3 +1,4 @@
+#include <fcntl.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdio.h>
@@ -5,35 +6,283 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include "vi.h"
 
+#define OUTMAX		(1 << 16)	/* maximum output buffer length */
+
 static struct sbuf term_sbuf;	/* output buffer if not NULL */
+static int term_sync;		/* a synchronized update has begun */
 static int rows, cols;		/* number of terminal rows and columns */
 static int win_top, win_rows;	/* active window rows */
 static int win_left, win_cols;	/* active window columns */
 static struct termios termios;
+static int term_mem;		/* use the in-memory terminal (vt.c) */
+static char *term_dump;		/* save the in-memory screen here at exit */
+static long out_bytes, out_frames;	/* output written to the in-memory terminal */
+static FILE *rec_fp;		/* recording terminal input */
+static long rec_last;		/* the time of the last recorded input */
+static char *rep_buf;		/* replayed terminal input */
+static long rep_len, rep_pos;	/* rep_buf[] length and position */
+static long rep_rem;		/* the unread part of the current input */
+static long rep_beg;		/* when replaying began */
+
+/* a screen cell */
+struct tcell {
+	char c[16];	/* the character; empty for the second column of wide characters */
+	int att;	/* text attributes */
+};
+
+static struct tcell *scr_front;	/* terminal contents */
+static struct tcell *scr_back;	/* rows drawn since the last flush */
+static char *scr_bad;		/* scr_bad[r]: row r of scr_front is unknown */
+static char *scr_dirty;		/* scr_dirty[r]: row r of scr_back should be written */
+static int scr_rows, scr_cols;	/* screen buffer dimensions */
+static int scr_row = -1;	/* the row being drawn */
+static int cur_row = -1;	/* cursor row, if known */
+
+static long write_fully(int fd, void *buf, long sz)
+{
+	long nw = 0, nc = 0;
+	while (nw < sz && (nc = write(fd, buf + nw, sz - nw)) >= 0)
+		nw += nc;
+	return nc >= 0 ? nw : -1;
+}
+
+/* write the decimal representation of a non-negative number */
+static char *term_num(char *d, int n)
+{
+	char t[16];
+	int i = 0;
+	do {
+		t[i++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	while (i > 0)
+		*d++ = t[--i];
+	return d;
+}
+
+/* the escape sequence for moving the cursor to row r and column c */
+static char *term_seqpos(char *d, int r, int c)
+{
+	char *s = d;
+	*s++ = '\33';
+	*s++ = '[';
+	s = term_num(s, r + 1);
+	*s++ = ';';
+	s = term_num(s, c + 1);
+	*s++ = 'H';
+	*s = '\0';
+	return d;
+}
+
+/* write to the terminal or the in-memory terminal */
+static void term_write(char *s, long n)
+{
+	if (term_mem) {
+		vt_write(s, n);
+		out_bytes += n;
+	} else {
+		write_fully(1, s, n);
+	}
+}
+
+static void term_out(char *s)
+{
+	if (!s[0])
+		return;
+	if (xsync && !term_sync) {
+		sbuf_str(&term_sbuf, "\33[?2026h");
+		term_sync = 1;
+	}
+	sbuf_str(&term_sbuf, s);
+	/* write huge updates in parts; the terminal waits for the end marker */
+	if (sbuf_len(&term_sbuf) >= OUTMAX) {
+		term_write(sbuf_buf(&term_sbuf), sbuf_len(&term_sbuf));
+		sbuf_cut(&term_sbuf, 0);
+	}
+}
+
+static void scr_init(void)
+{
+	free(scr_front);
+	free(scr_back);
+	free(scr_bad);
+	free(scr_dirty);
+	scr_rows = rows;
+	scr_cols = cols;
+	scr_front = malloc(scr_rows * scr_cols * sizeof(scr_front[0]));
+	scr_back = malloc(scr_rows * scr_cols * sizeof(scr_back[0]));
+	scr_bad = malloc(scr_rows);
+	scr_dirty = malloc(scr_rows);
+	memset(scr_bad, 1, scr_rows);
+	memset(scr_dirty, 0, scr_rows);
+	scr_row = -1;
+	cur_row = -1;
+}
+
+static void scr_free(void)
+{
+	free(scr_front);
+	free(scr_back);
+	free(scr_bad);
+	free(scr_dirty);
+	scr_front = NULL;
+	scr_back = NULL;
+	scr_bad = NULL;
+	scr_dirty = NULL;
+	scr_rows = 0;
+	scr_cols = 0;
+}
+
+static int cell_blank(struct tcell *c)
+{
+	return c->c[0] == ' ' && !c->c[1];
+}
+
+static int cell_same(struct tcell *c1, struct tcell *c2)
+{
+	return c1->att == c2->att && !strcmp(c1->c, c2->c);
+}
+
+/* write the changed cells of row r */
+static void scr_flushrow(int r, int *att)
+{
+	struct tcell *f = scr_front + r * scr_cols;
+	struct tcell *b = scr_back + r * scr_cols;
+	int bad = scr_bad[r];
+	int tail = scr_cols;	/* the trailing blanks, if any, begin here */
+	char cmd[32];
+	int i = 0, j;
+	while (tail > 0 && cell_blank(&b[tail - 1]) && b[tail - 1].att == b[scr_cols - 1].att)
+		tail--;
+	while (i < tail) {
+		int beg, end, same = 0;
+		if (!bad && cell_same(&f[i], &b[i])) {
+			i++;
+			continue;
+		}
+		beg = i;
+		if (beg > 0 && (!b[beg].c[0] || !f[beg].c[0]))
+			beg--;
+		/* include unchanged cells if cheaper than moving the cursor */
+		for (end = i + 1; end < tail && same < 8; end++)
+			same = !bad && cell_same(&f[end], &b[end]) ? same + 1 : 0;
+		end -= same;
+		while (end < tail && !b[end].c[0])
+			end++;
+		term_out(term_seqpos(cmd, r, beg));
+		for (j = beg; j < end; j++) {
+			if (!b[j].c[0])
+				continue;
+			term_out(term_seqattr(b[j].att, *att));
+			*att = b[j].att;
+			term_out(b[j].c);
+		}
+		i = end;
+	}
+	for (j = tail; j < scr_cols && !bad && cell_same(&f[j], &b[j]); j++)
+		;
+	if (j < scr_cols) {
+		term_out(term_seqpos(cmd, r, tail));
+		term_out(term_seqattr(b[tail].att, *att));
+		*att = b[tail].att;
+		term_out("\33[K");
+	}
+	memcpy(f, b, scr_cols * sizeof(b[0]));
+	scr_bad[r] = 0;
+	scr_dirty[r] = 0;
+}
+
+/* write the rows drawn in the screen buffer */
+static void scr_flush(void)
+{
+	int att = 0;
+	int r, vte = xvte;
+	for (r = 0; r < scr_rows; r++) {
+		if (scr_dirty[r]) {
+			if (vte)	/* disable BiDi in vte-based terminals */
+				term_out("\33[8l");
+			vte = 0;
+			scr_flushrow(r, &att);
+		}
+	}
+	term_out(term_seqattr(0, att));
+	scr_row = -1;
+}
+
+/* the screen content of the cursor row is changed */
+static void scr_touch(char *s)
+{
+	if (!scr_rows)
+		return;
+	if (cur_row < 0 || strchr(s, '\n') || strchr(s, '\r')) {
+		memset(scr_bad, 1, scr_rows);
+		cur_row = -1;
+	} else {
+		scr_bad[cur_row] = 1;
+	}
+}
+
+/* start drawing the given window row (the cursor row if -1) in the screen buffer */
+int term_grid(int row)
+{
+	int r = row < 0 ? cur_row : win_top + row;
+	int i;
+	if (r < 0 || r >= scr_rows || win_cols > scr_cols)
+		return 1;
+	for (i = 0; i < scr_cols; i++) {
+		strcpy(scr_back[r * scr_cols + i].c, " ");
+		scr_back[r * scr_cols + i].att = 0;
+	}
+	scr_dirty[r] = 1;
+	scr_row = r;
+	return 0;
+}
+
+/* set the cell at the given column of the row being drawn */
+void term_cell(int col, char *s, int wid, int att)
+{
+	struct tcell *c = scr_back + scr_row * scr_cols;
+	int i;
+	if (scr_row < 0 || col < 0 || col + MAX(1, wid) > scr_cols)
+		return;
+	snprintf(c[col].c, sizeof(c[col].c), "%s", s);
+	c[col].att = att;
+	for (i = 1; i < wid; i++) {
+		c[col + i].c[0] = '\0';
+		c[col + i].att = att;
+	}
+}
 
 void term_init(void)
 {
 	struct winsize win;
 	struct termios newtermios;
-	tcgetattr(0, &termios);
-	newtermios = termios;
-	newtermios.c_lflag &= ~(ICANON | ISIG);
-	newtermios.c_lflag &= ~ECHO;
-	tcsetattr(0, TCSAFLUSH, &newtermios);
+	if (!term_mem) {
+		tcgetattr(0, &termios);
+		newtermios = termios;
+		newtermios.c_lflag &= ~(ICANON | ISIG);
+		newtermios.c_lflag &= ~ECHO;
+		tcsetattr(0, TCSAFLUSH, &newtermios);
+	}
 	if (getenv("LINES"))
 		rows = atoi(getenv("LINES"));
 	if (getenv("COLUMNS"))
 		cols = atoi(getenv("COLUMNS"));
-	if (!ioctl(0, TIOCGWINSZ, &win)) {
+	if (!term_mem && !ioctl(0, TIOCGWINSZ, &win)) {
 		cols = win.ws_col;
 		rows = win.ws_row;
 	}
 	cols = cols ? cols : 80;
 	rows = rows ? rows : 25;
-	term_str("\33[m");
+	if (term_mem)
+		vt_init(rows, cols);
+	scr_init();
+	term_out("\33[m");
+	term_out("\33[?2004h");	/* bracketed paste */
 	term_window(win_top, win_rows > 0 ? win_rows : rows);
 }
 
@@ -44,22 +293,28 @@ void term_window(int row, int cnt)
 	win_rows = cnt;
 	win_left = 0;
 	win_cols = cols;
+	term_flush();
+	cur_row = -1;
 	if (row == 0 && win_rows == rows) {
-		term_str("\33[r");
+		term_out("\33[r");
 	} else {
 		sprintf(cmd, "\33[%d;%dr", win_top + 1, win_top + win_rows);
-		term_str(cmd);
+		term_out(cmd);
 	}
 }
 
 void term_done(void)
 {
-	term_str("\33[r");
+	term_flush();
+	term_out("\33[?2004l");
+	term_out("\33[r");
 	term_pos(rows - 1, 0);
 	term_kill();
 	term_commit();
 	sbuf_free(&term_sbuf);
-	tcsetattr(0, 0, &termios);
+	scr_free();
+	if (!term_mem)
+		tcsetattr(0, 0, &termios);
 }
 
 void term_suspend(void)
@@ -69,23 +324,34 @@ void term_suspend(void)
 	term_init();
 }
 
-static long write_fully(int fd, void *buf, long sz)
+/* write the rows drawn in the screen buffer to the output buffer */
+void term_flush(void)
 {
-	long nw = 0, nc = 0;
-	while (nw < sz && (nc = write(fd, buf + nw, sz - nw)) >= 0)
-		nw += nc;
-	return nc >= 0 ? nw : -1;
+	if (scr_rows && memchr(scr_dirty, 1, scr_rows))
+		scr_flush();
 }
 
 void term_commit(void)
 {
-	write_fully(1, sbuf_buf(&term_sbuf), sbuf_len(&term_sbuf));
+	PROF_BEG(PROF_TERM);
+	term_flush();
+	if (term_sync)
+		sbuf_str(&term_sbuf, "\33[?2026l");
+	term_sync = 0;
+	if (sbuf_len(&term_sbuf)) {
+		term_write(sbuf_buf(&term_sbuf), sbuf_len(&term_sbuf));
+		out_frames++;
+		lat_paint();
+	}
+	PROF_END(PROF_TERM, sbuf_len(&term_sbuf));
 	sbuf_cut(&term_sbuf, 0);
 }
 
 void term_str(char *s)
 {
-	sbuf_str(&term_sbuf, s);
+	term_flush();
+	scr_touch(s);
+	term_out(s);
 }
 
 void term_chr(int ch)
@@ -99,15 +365,45 @@ void term_kill(void)
 	term_str("\33[K");
 }
 
+/* insert (if positive) or delete lines at the cursor row */
 void term_room(int n)
 {
 	char cmd[16];
+	int end = win_top + win_rows;
+	int i;
+	if (!n)
+		return;
+	term_flush();
 	if (n < 0)
 		sprintf(cmd, "\33[%dM", -n);
 	if (n > 0)
 		sprintf(cmd, "\33[%dL", n);
-	if (n)
-		term_str(cmd);
+	term_out(cmd);
+	if (!scr_rows)
+		return;
+	if (cur_row < win_top || cur_row >= end || end > scr_rows) {
+		memset(scr_bad, 1, scr_rows);
+		return;
+	}
+	n = MAX(-(end - cur_row), MIN(n, end - cur_row));
+	if (n > 0) {
+		memmove(scr_front + (cur_row + n) * scr_cols, scr_front + cur_row * scr_cols,
+			(end - cur_row - n) * scr_cols * sizeof(scr_front[0]));
+		memmove(scr_bad + cur_row + n, scr_bad + cur_row, end - cur_row - n);
+	} else {
+		memmove(scr_front + cur_row * scr_cols, scr_front + (cur_row - n) * scr_cols,
+			(end - cur_row + n) * scr_cols * sizeof(scr_front[0]));
+		memmove(scr_bad + cur_row, scr_bad + cur_row - n, end - cur_row + n);
+	}
+	/* the new lines are blank */
+	for (i = n > 0 ? cur_row : end + n; i < (n > 0 ? cur_row + n : end); i++) {
+		int j;
+		for (j = 0; j < scr_cols; j++) {
+			strcpy(scr_front[i * scr_cols + j].c, " ");
+			scr_front[i * scr_cols + j].att = 0;
+		}
+		scr_bad[i] = 0;
+	}
 }
 
 void term_pos(int r, int c)
@@ -120,8 +416,11 @@ void term_pos(int r, int c)
 	if (r < 0)
 		sprintf(buf, "\33[%dG", win_left + c + 1);
 	else
-		sprintf(buf, "\33[%d;%dH", win_top + r + 1, win_left + c + 1);
-	term_str(buf);
+		term_seqpos(buf, win_top + r, win_left + c);
+	term_flush();
+	if (r >= 0)
+		cur_row = win_top + r;
+	term_out(buf);
 }
 
 int term_rowx(void)
@@ -171,38 +470,212 @@ char *term_cmd(int *n)
 	return icmd;
 }
 
-int term_read(int buffered)
+static long term_msec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* use the in-memory terminal; its final contents are saved in dump, if given */
+void term_headless(char *dump)
+{
+	term_mem = 1;
+	term_dump = dump;
+}
+
+/* record terminal input in the given file */
+int term_record(char *path)
+{
+	if (!(rec_fp = fopen(path, "w")))
+		return 1;
+	rec_last = term_msec();
+	return 0;
+}
+
+/* read terminal input from a file recorded with term_record() */
+int term_replay(char *path)
+{
+	struct sbuf sb = {0};
+	char buf[1024];
+	int fd = open(path, O_RDONLY);
+	long n;
+	if (fd < 0)
+		return 1;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		sbuf_mem(&sb, buf, n);
+	close(fd);
+	rep_len = sbuf_len(&sb);
+	rep_buf = sbuf_done(&sb);
+	rep_beg = term_msec();
+	term_mem = 1;
+	return 0;
+}
+
+/* stop recording, report replay statistics, and save the in-memory screen */
+void term_finish(void)
+{
+	if (rec_fp)
+		fclose(rec_fp);
+	rec_fp = NULL;
+	if (rep_buf)
+		fprintf(stderr, "replay: %ld ms, %ld frames, %ld bytes, %ld bytes/frame\n",
+			term_msec() - rep_beg, out_frames, out_bytes,
+			out_frames ? out_bytes / out_frames : 0);
+	free(rep_buf);
+	rep_buf = NULL;
+	if (term_mem && term_dump)
+		vt_save(term_dump);
+	vt_done();
+}
+
+/* the next part of replayed input; each part was read at once when recording */
+static int term_replayed(char *buf, int len)
+{
+	if (!rep_rem) {
+		char *s = rep_buf + rep_pos;
+		char *r;
+		long n;
+		strtol(s, &r, 10);	/* the delay since the previous input */
+		n = strtol(r, &s, 10);
+		if (*s != '\n' || n <= 0 || n > rep_len - (s + 1 - rep_buf)) {
+			rep_pos = rep_len;
+			xquit = 1;
+			return -1;
+		}
+		rep_pos = s + 1 - rep_buf;
+		rep_rem = n;
+	}
+	len = MIN(len, rep_rem);
+	memcpy(buf, rep_buf + rep_pos, len);
+	rep_pos += len;
+	rep_rem -= len;
+	return len;
+}
+
+/* read terminal input; returns the number of bytes read or -1 */
+static int term_input(char *buf, int len, int timeout)
 {
 	struct pollfd ufds[1];
+	long now;
+	int n;
+	if (rep_buf)
+		return term_replayed(buf, len);
+	ufds[0].fd = 0;
+	ufds[0].events = POLLIN;
+	if (ev_poll(ufds, 1, timeout) <= 0)
+		return -1;
+	if ((n = read(0, buf, len)) <= 0)
+		return -1;
+	lat_input();
+	if (rec_fp) {
+		now = term_msec();
+		fprintf(rec_fp, "%ld %d\n", now - rec_last, n);
+		fwrite(buf, 1, n, rec_fp);
+		fflush(rec_fp);
+		rec_last = now;
+	}
+	return n;
+}
+
+int term_read(int buffered)
+{
 	int n, c;
 	if (!buffered && ibuf_pos >= ibuf_cnt && istd_pos >= istd_cnt) {
-		ufds[0].fd = 0;
-		ufds[0].events = POLLIN;
-		if (poll(ufds, 1, -1) <= 0)
-			return -1;
-		if ((n = read(0, istd, sizeof(istd))) <= 0)
+		if ((n = term_input(istd, sizeof(istd), -1)) <= 0)
 			return -1;
 		istd_cnt = n;
 		istd_pos = 0;
 	}
-	if (ibuf_pos < ibuf_cnt)
+	if (ibuf_pos < ibuf_cnt) {
 		c = (unsigned char) ibuf[ibuf_pos++];
-	else
+		lat_key(0);
+	} else {
 		c = istd_pos < istd_cnt ? (unsigned char) istd[istd_pos++] : -1;
+		if (c >= 0)
+			lat_key(1);
+	}
 	if (icmd_pos < sizeof(icmd) && c >= 0)
 		icmd[icmd_pos++] = c;
 	return c;
 }
 
-/* return a static string that changes text attributes from old to att */
-char *term_seqattr(int att, int old)
+/* return nonzero if more input can be read without blocking */
+int term_pending(void)
+{
+	struct pollfd ufds[1];
+	if (term_mem)		/* draw after each command, for reproducible output */
+		return 0;
+	if (ibuf_pos < ibuf_cnt || istd_pos < istd_cnt)
+		return 1;
+	ufds[0].fd = 0;
+	ufds[0].events = POLLIN;
+	return ev_poll(ufds, 1, 0) > 0 && ufds[0].revents & POLLIN;
+}
+
+/* read more input into istd[]; returns nonzero if nothing was read */
+static int term_fill(int timeout)
+{
+	int n;
+	memmove(istd, istd + istd_pos, istd_cnt - istd_pos);
+	istd_cnt -= istd_pos;
+	istd_pos = 0;
+	if (istd_cnt >= sizeof(istd))
+		return 1;
+	if ((n = term_input(istd + istd_cnt, sizeof(istd) - istd_cnt, timeout)) <= 0)
+		return 1;
+	istd_cnt += n;
+	return 0;
+}
+
+/* called after reading an escape; return the text of a bracketed paste, if any */
+char *term_paste(void)
+{
+	char *beg = "[200~";
+	char *end = "\33[201~";
+	struct sbuf sb = {0};
+	int i = 0, n;
+	if (ibuf_pos < ibuf_cnt)
+		return NULL;
+	while (beg[i]) {
+		if (istd_pos + i >= istd_cnt && (!i || term_fill(100)))
+			return NULL;
+		if (istd[istd_pos + i] != beg[i])
+			return NULL;
+		i++;
+	}
+	istd_pos += i;
+	while (1) {
+		n = sbuf_len(&sb) - strlen(end);
+		if (n >= 0 && !memcmp(sbuf_buf(&sb) + n, end, strlen(end))) {
+			sbuf_cut(&sb, n);
+			break;
+		}
+		if (istd_pos >= istd_cnt && term_fill(1000))
+			break;
+		sbuf_chr(&sb, (unsigned char) istd[istd_pos++]);
+	}
+	/* terminals send line breaks as \r */
+	for (i = 0, n = 0; i < sbuf_len(&sb); i++) {
+		char c = sbuf_buf(&sb)[i];
+		if (c == '\r' && i + 1 < sbuf_len(&sb) && sbuf_buf(&sb)[i + 1] == '\n')
+			continue;
+		sbuf_buf(&sb)[n++] = c == '\r' ? '\n' : c;
+	}
+	sbuf_cut(&sb, n);
+	/* record the text instead of the escape for term_cmd() */
+	if (icmd_pos > 0 && icmd[icmd_pos - 1] == TK_ESC)
+		icmd_pos--;
+	for (i = 0; i < sbuf_len(&sb) && icmd_pos < sizeof(icmd); i++)
+		icmd[icmd_pos++] = sbuf_buf(&sb)[i];
+	return sbuf_done(&sb);
+}
+
+/* the escape sequence for setting text attributes */
+static void term_mkattr(char *s, int att)
 {
-	static char buf[128];
-	char *s = buf;
 	int fg = SYN_FG(att);
 	int bg = SYN_BG(att);
-	if (att == old)
-		return "";
 	s += sprintf(s, "\33[");
 	if (att & SYN_BD)
 		s += sprintf(s, ";1");
@@ -223,7 +696,25 @@ char *term_seqattr(int att, int old)
 			s += sprintf(s, ";48;5;%d", (bg & 0xff));
 	}
 	s += sprintf(s, "m");
-	return buf;
+}
+
+/* recently used attribute sequences; they do not depend on the old attributes */
+static struct {
+	int att;
+	char seq[32];
+} seqattr[256];
+
+/* return a static string that changes text attributes from old to att */
+char *term_seqattr(int att, int old)
+{
+	int i = ((unsigned) att * 2654435761u) >> 24;
+	if (att == old)
+		return "";
+	if (!seqattr[i].seq[0] || seqattr[i].att != att) {
+		term_mkattr(seqattr[i].seq, att);
+		seqattr[i].att = att;
+	}
+	return seqattr[i].seq;
 }
 
 char *term_seqkill(void)
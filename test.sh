@@ -22,3 +22,8 @@ done
 for x in test/v??.sh; do
 	testcase "-v" "$x"
 done
+# screen tests: the contents of an in-memory terminal are compared
+export LINES=8 COLUMNS=40
+for x in test/s??.sh; do
+	testcase "-d /tmp/.neatvi2 -v" "$x"
+done
@@ -0,0 +1,23 @@
+# ex commands
+echo    ":e $1"
+echo    ":a"
+echo    "abc"
+echo    "xyz"
+echo    "abd"
+echo    "abe"
+echo    "."
+echo    ":4ka"
+echo    ":%s/b/B/"
+echo    ":'ad"
+echo    ":u"
+echo    ":u"
+echo    ":2s/y/Y/"
+echo    ":redo"
+echo    ":'ad"
+echo    ":%s/d/D/g"
+echo    ":wq"
+
+# the expected output
+echo    "abc" >&2
+echo    "xYz" >&2
+echo    "abD" >&2
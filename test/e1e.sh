@@ -0,0 +1,31 @@
+# batch mode: vi -b script files...
+rm -f $1.*
+printf 'abc\n' >$1.a
+printf 'xyz\n' >$1.b
+printf 'bbb\n' >$1.t
+ln -s $1.t $1.c
+printf 'cba\n' >$1.h
+ln $1.h $1.g
+printf ':%%s/b/B/\n' >$1.ex
+./vi -b $1.ex $1.a $1.b $1.c $1.g $1.d >$1.res
+echo "exit $?" >>$1.res
+test -h $1.c && echo "symlink kept" >>$1.res
+cat $1.a $1.b $1.t $1.h >>$1.res
+echo    ":e! $1.res"
+echo    ":1,5!sort"
+echo    ":w! $1"
+echo    ":q!"
+
+# the expected output
+echo    "$1.a: written" >&2
+echo    "$1.b: unchanged" >&2
+echo    "$1.c: written" >&2
+echo    "$1.d: failed" >&2
+echo    "$1.g: written" >&2
+echo    "5 files: 3 written, 1 unchanged, 1 failed" >&2
+echo    "exit 1" >&2
+echo    "symlink kept" >&2
+echo    "aBc" >&2
+echo    "xyz" >&2
+echo    "Bbb" >&2
+echo    "cBa" >&2
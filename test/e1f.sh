@@ -0,0 +1,27 @@
+# the output of a background job as the quick fix list
+printf "one\ntwo\nthree\n" >$1.a
+printf "%s\n" "$1.a:2: second" "$1.a:3:2: third" >$1.q
+
+# ex commands
+echo    ":job cat $1.q"
+sleep 1
+echo    ":cc"
+echo    ":s/$/ A/"
+echo    ":w"
+echo    ":cn"
+echo    ":s/$/ B/"
+echo    ":w"
+echo    ":cn"
+echo    ":1"
+echo    ":cc"
+echo    ":s/$/ C/"
+echo    ":\$pu *"
+echo    ":w! $1"
+echo    ":q!"
+
+# the expected output
+echo    "one" >&2
+echo    "two A" >&2
+echo    "three B C" >&2
+echo    "$1.a:2: second" >&2
+echo    "$1.a:3:2: third" >&2
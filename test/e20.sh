@@ -0,0 +1,23 @@
+# ex commands
+echo    ":se bm=0"
+echo    ":e! $1.a"
+echo    ":%d"
+echo    ":a"
+echo    "abc"
+echo    "def"
+echo    "ghi"
+echo    "."
+echo    ":2k a"
+echo    ":w!"
+echo    ":e $1.b"
+echo    ":w!"
+echo    ":e $1.c"
+echo    ":w!"
+echo    ":e $1.a"
+echo    ":'ad"
+echo    ":w! $1"
+echo    ":q!"
+
+# the expected output
+echo    "abc" >&2
+echo    "ghi" >&2
@@ -0,0 +1,11 @@
+# switching to an unloaded buffer that was shortened and read in the background
+rm -f $1.*
+printf 'a\nb\nc\nd\ne\n' >$1.a
+printf 'y\n' >$1.y
+printf 'z\n' >$1.z
+printf '%s\n' ":se bm=0" ":5" ":n" ":n" ":!printf 'x\\\\n' >$1.a" ":prev" ":prev" \
+	":s/^/>/" ":w! $1" ":q!" | ./vi -s -e $1.a $1.y $1.z >/dev/null 2>&1
+echo    ":q!"
+
+# the expected output
+echo    ">x" >&2
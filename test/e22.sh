@@ -0,0 +1,25 @@
+# appending to a register after reading it
+echo    ":e! $1"
+echo    ":%d"
+echo    ":a"
+echo    "abc"
+echo    "def"
+echo    "ghi"
+echo    "."
+echo    ":1y a"
+echo    ":2y A"
+echo    ":\$pu a"
+echo    ":3y A"
+echo    ":\$pu a"
+echo    ":w!"
+echo    ":q!"
+
+# the expected output
+echo    "abc" >&2
+echo    "def" >&2
+echo    "ghi" >&2
+echo    "abc" >&2
+echo    "def" >&2
+echo    "abc" >&2
+echo    "def" >&2
+echo    "ghi" >&2
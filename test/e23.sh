@@ -0,0 +1,22 @@
+# marks of lines changed by a substitution after undoing it
+echo    ":e! $1"
+echo    ":%d"
+echo    ":a"
+echo    "abc"
+echo    "def"
+echo    "ghi"
+echo    "jkl"
+echo    "."
+echo    ":2k a"
+echo    ":3k b"
+echo    ":%s/[eh]/x/"
+echo    ":u"
+echo    ":'ad"
+echo    ":'bs/^/>/"
+echo    ":w!"
+echo    ":q!"
+
+# the expected output
+echo    "abc" >&2
+echo    ">ghi" >&2
+echo    "jkl" >&2
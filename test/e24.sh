@@ -0,0 +1,15 @@
+# the first :s and :g of a process on enough lines for several threads
+rm -f $1.*
+awk 'BEGIN {for (i = 0; i < 40000; i++) print "é " i " ü"}' >$1.a
+printf '%s\n' ":%s/é ([0-9]*)5 ü/\\1 ë/" ":g/7 ü$/d" ":w! $1" ":q!" | \
+	./vi -s -e $1.a >/dev/null 2>&1
+echo    ":q!"
+
+# the expected output
+awk 'BEGIN {
+	for (i = 0; i < 40000; i++)
+		if (i % 10 == 5)
+			print (i < 10 ? "" : int(i / 10)) " ë"
+		else if (i % 10 != 7)
+			print "é " i " ü"
+}' >&2
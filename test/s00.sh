@@ -0,0 +1,16 @@
+#!/bin/sh
+
+# screen contents after inserting, yanking and putting lines
+printf	"ione\ntwo\nthree\033"
+printf	"kyyP"
+echo	":q!"
+
+# the expected screen
+echo	"one" >&2
+echo	"two" >&2
+echo	"two" >&2
+echo	"three" >&2
+echo	"~" >&2
+echo	"~" >&2
+echo	"~" >&2
+echo	"" >&2
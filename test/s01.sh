@@ -0,0 +1,16 @@
+#!/bin/sh
+
+# scrolling and wide characters
+printf	"i1\n2\n3\n4\n5\n6\n7\n8\n9\n\344\270\255\346\226\207 abcdefghijklmnopqrstuvwxyz0123456789\033"
+printf	"gg10j0"
+echo	":q!"
+
+# the expected screen
+echo	"4" >&2
+echo	"5" >&2
+echo	"6" >&2
+echo	"7" >&2
+echo	"8" >&2
+echo	"9" >&2
+echo	"中文 abcdefghijklmnopqrstuvwxyz012345678" >&2
+echo	"" >&2
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# editing a long line, which is drawn from the gap buffer
+printf	"i"
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30; do
+	printf	"0123456789"
+done
+printf	"\033"
+printf	"0155|iabcdefghijklmnopqrstuvwxyz\tABCDEFGHIJKLMNOPQRSTUVWXYZ\b\b\033"
+echo	":q!"
+
+# the expected screen
+echo	"uvwxyz    ABCDEFGHIJKLMNOPQRSTUVWX456789" >&2
+echo	"" >&2
+echo	"" >&2
+echo	"" >&2
+echo	"" >&2
+echo	"" >&2
+echo	"" >&2
+echo	"" >&2
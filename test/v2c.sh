@@ -0,0 +1,21 @@
+#!/bin/sh
+
+# bracketed paste
+echo    ":e $1"
+echo    ":set ai"
+printf	"i  x\033[200~abc\n  def\n\tghi\033[201~jkl\n"
+printf	"mno\033"
+printf	"o\033[200~p\rq\r\nr\033[201~\033"
+printf	"\033[200~~s\ry\033[201~"
+echo    ":w"
+echo    ":q"
+
+# the expected output
+echo    "  xabc" >&2
+echo    "  def" >&2
+echo    "	ghijkl" >&2
+echo    "	mno" >&2
+echo    "	p" >&2
+echo    "q" >&2
+echo    "~s" >&2
+echo    "yr" >&2
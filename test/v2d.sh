@@ -0,0 +1,13 @@
+#!/bin/sh
+
+# editing keys and undo in insert mode
+echo    ":e $1"
+printf	"ihello wor\bld foo\027bar\nxyz\024ab\004c\033"
+printf	"0a\342\202\254\342\202\254x\b\b\033"
+printf	"ktlix\033uAend\033"
+echo    ":w"
+echo    ":q"
+
+# the expected output
+echo    "hello wold barend" >&2
+echo    "x€yzabc" >&2
@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -313,7 +314,8 @@ static int uc_acomb(int c)
 		c == 0x0670;				/* superscript alef */
 }
 
-static void uc_cput(char *d, int c)
+/* write the utf-8 encoding of c */
+void uc_cput(char *d, int c)
 {
 	int l = 0;
 	if (c > 0xffff) {
@@ -333,33 +335,30 @@ static void uc_cput(char *d, int c)
 	*d = '\0';
 }
 
-/* shape the given arabic character; returns a static buffer */
-char *uc_shape(char *beg, char *s)
+/* shape the arabic characters in chrs; returns the shaped code of right-to-left characters and zero for others */
+int *uc_shape(char **chrs, int n)
 {
-	static char out[16];
-	char *r;
+	int *code = malloc((n + 1) * sizeof(code[0]));
+	int *out = malloc((n + 1) * sizeof(out[0]));
 	int prev = 0;
 	int next = 0;
-	int curr = uc_code(s);
-	if (!curr || !UC_R2L(curr))
-		return NULL;
-	r = s;
-	while (r > beg) {
-		r = uc_beg(beg, r - 1);
-		if (!uc_acomb(uc_code(r))) {
-			prev = uc_code(r);
-			break;
-		}
+	int i;
+	/* out[i] is first the previous non-combining character */
+	for (i = 0; i < n; i++) {
+		code[i] = uc_code(chrs[i]);
+		out[i] = prev;
+		if (!uc_acomb(code[i]))
+			prev = code[i];
 	}
-	r = s;
-	while (*r) {
-		r = uc_next(r);
-		if (!uc_acomb(uc_code(r))) {
-			next = uc_code(r);
-			break;
-		}
+	for (i = n - 1; i >= 0; i--) {
+		if (code[i] && UC_R2L(code[i]))
+			out[i] = uc_cshape(code[i], out[i], next);
+		else
+			out[i] = 0;
+		if (!uc_acomb(code[i]))
+			next = code[i];
 	}
-	uc_cput(out, uc_cshape(curr, prev, next));
+	free(code);
 	return out;
 }
 
@@ -563,53 +562,93 @@ static int bchars[][2] = {
 	{0x2b736, 0x2f7ff}, {0x2fa1f, 0x10ffff},
 };
 
-static int find(int c, int tab[][2], int n)
+#define UC_ZW		0x01	/* zero-width */
+#define UC_DW		0x02	/* double-width */
+#define UC_BELL		0x04	/* nonprintable */
+
+/* a two-level table of character flags; uc_tab1[c >> 8] indexes 256-entry blocks */
+static unsigned short uc_tab1[0x1100];
+static unsigned char (*uc_tab2)[256];
+static int uc_tab2_n;
+
+static void uc_tabfill(unsigned char *d, int beg, int tab[][2], int n, int *idx, int flg)
 {
-	int l = 0;
-	int h = n - 1;
-	int m;
-	if (c < tab[0][0])
-		return 0;
-	while (l <= h) {
-		m = (h + l) / 2;
-		if (c >= tab[m][0] && c <= tab[m][1])
-			return 1;
-		if (c < tab[m][0])
-			h = m - 1;
-		else
-			l = m + 1;
-	}
-	return 0;
+	int end = beg + 256;
+	int i, c;
+	while (*idx < n && tab[*idx][1] < beg)
+		(*idx)++;
+	for (i = *idx; i < n && tab[i][0] < end; i++)
+		for (c = MAX(tab[i][0], beg); c <= tab[i][1] && c < end; c++)
+			d[c - beg] |= flg;
 }
 
-/* double-width characters */
-static int uc_isdw(int c)
+static int uc_tabadd(unsigned char *blk)
 {
-	return c >= 0x1100 && find(c, dwchars, LEN(dwchars));
+	if (uc_tab2_n && !memcmp(uc_tab2[uc_tab2_n - 1], blk, 256))
+		return uc_tab2_n - 1;
+	if (uc_tab2_n % 64 == 0) {
+		void *tab2 = realloc(uc_tab2, (uc_tab2_n + 64) * sizeof(uc_tab2[0]));
+		if (!tab2)
+			return 0;
+		uc_tab2 = tab2;
+	}
+	memcpy(uc_tab2[uc_tab2_n], blk, 256);
+	return uc_tab2_n++;
+}
+
+/* build the table from dwchars, zwchars and bchars ranges */
+static void uc_tabinit(void)
+{
+	unsigned char blk[256];
+	int uni[256];		/* blocks filled with a single value */
+	int dw = 0, zw = 0, bc = 0;
+	int i, j;
+	memset(uni, 0xff, sizeof(uni));
+	for (i = 0; i < LEN(uc_tab1); i++) {
+		memset(blk, 0, sizeof(blk));
+		uc_tabfill(blk, i << 8, dwchars, LEN(dwchars), &dw, UC_DW);
+		uc_tabfill(blk, i << 8, zwchars, LEN(zwchars), &zw, UC_ZW | UC_BELL);
+		uc_tabfill(blk, i << 8, bchars, LEN(bchars), &bc, UC_BELL);
+		for (j = 1; j < 256 && blk[j] == blk[0]; j++)
+			;
+		if (j < 256) {
+			uc_tab1[i] = uc_tabadd(blk);
+		} else {
+			if (uni[blk[0]] < 0)
+				uni[blk[0]] = uc_tabadd(blk);
+			uc_tab1[i] = uni[blk[0]];
+		}
+	}
 }
 
-/* zero-width and combining characters */
-static int uc_iszw(int c)
+static pthread_once_t uc_once = PTHREAD_ONCE_INIT;
+
+static int uc_flags(int c)
 {
-	return c >= 0x0300 && find(c, zwchars, LEN(zwchars));
+	pthread_once(&uc_once, uc_tabinit);	/* :s and :g call it from several threads */
+	if (c < 0 || c >= (LEN(uc_tab1) << 8) || !uc_tab2)
+		return 0;
+	return uc_tab2[uc_tab1[c >> 8]][c & 0xff];
 }
 
 int uc_wid(char *s)
 {
-	int c = uc_code(s);
-	if (uc_iszw(c))
+	int c = (unsigned char) *s;
+	if (c < 0x80)
+		return 1;
+	c = uc_flags(uc_code(s));
+	if (c & UC_ZW)
 		return 0;
-	return uc_isdw(c) ? 2 : 1;
+	return c & UC_DW ? 2 : 1;
 }
 
 /* nonprintable characters */
 int uc_isbell(char *s)
 {
 	int c = (unsigned char) *s;
-	if (c == ' ' || c == '\t' || c == '\n' || (c >= 0x20 && c < 0x7f))
-		return 0;
-	c = uc_code(s);
-	return uc_iszw(c) || find(c, bchars, LEN(bchars));
+	if (c < 0x80)
+		return c < 0x20 && c != '\t' && c != '\n';
+	return (uc_flags(uc_code(s)) & UC_BELL) != 0;
 }
 
 /* combining characters */
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include "vi.h"
 
@@ -52,11 +53,11 @@ static int w_tmp;		/* temporary window */
 static char *w_path;		/* saved window path */
 static int w_row, w_off, w_top, w_left;	/* saved window configuration */
 static int glob_id[128];	/* global mark buffer IDs */
-
-static char *vi_ledmod;		/* led_print() data for the status line */
-static char *vi_ledins;		/* led_print() data for xrow when vi_insert is one */
+static int vi_stale;		/* screen updates were skipped */
+static int vi_idle;		/* waiting for a new command */
 
 static int vc_status(void);
+static int vi_off2col(struct lbuf *lb, int row, int off);
 
 static int xtd_set(int td)
 {
@@ -65,6 +66,201 @@ static int xtd_set(int td)
 	return old;
 }
 
+/* the line being edited in insert mode, kept in a gap buffer */
+static char *gb_buf;		/* line contents around the gap */
+static int gb_sz;		/* size of gb_buf */
+static int gb_beg, gb_end;	/* the gap: gb_buf[gb_beg..gb_end) */
+static int gb_off;		/* character offset of the gap */
+static int gb_row = -1;		/* the line in gb_buf or -1 */
+static int gb_mod;		/* gb_buf differs from the line in xb */
+static struct sbuf gb_ln;	/* contiguous copy of the line */
+static int gb_lnok;		/* gb_ln is up to date */
+static int gb_n;		/* number of characters in the line */
+static int gb_ctx;		/* direction context of the line */
+static int gb_ckb, gb_ckc;	/* a checkpoint before the gap: byte offset and column */
+
+static char *gb_get(void)
+{
+	if (!gb_lnok) {
+		sbuf_cut(&gb_ln, 0);
+		sbuf_mem(&gb_ln, gb_buf, gb_beg);
+		sbuf_mem(&gb_ln, gb_buf + gb_end, gb_sz - gb_end);
+		sbuf_chr(&gb_ln, '\n');
+		gb_lnok = 1;
+	}
+	return sbuf_buf(&gb_ln);
+}
+
+/* write the line back to xb */
+static void gb_commit(void)
+{
+	if (gb_row >= 0 && gb_mod)
+		lbuf_edit(xb, gb_get(), gb_row, gb_row + 1);
+	gb_row = -1;
+	gb_mod = 0;
+}
+
+static void gb_grow(int n)
+{
+	int sz = gb_sz * 2 + n;
+	char *buf = malloc(sz);
+	memcpy(buf, gb_buf, gb_beg);
+	memcpy(buf + sz - (gb_sz - gb_end), gb_buf + gb_end, gb_sz - gb_end);
+	free(gb_buf);
+	gb_end = sz - (gb_sz - gb_end);
+	gb_buf = buf;
+	gb_sz = sz;
+}
+
+static int gb_load(int row)
+{
+	char *ln;
+	int n;
+	if (gb_row == row)
+		return 0;
+	gb_commit();
+	if (!(ln = lbuf_get(xb, row)))
+		return 1;
+	n = strlen(ln) - 1;
+	gb_beg = 0;
+	gb_end = gb_sz;
+	if (gb_sz < n + 64)
+		gb_grow(n + 64);
+	memcpy(gb_buf, ln, n);
+	gb_beg = n;
+	gb_off = uc_slen(ln) - 1;
+	gb_n = gb_off;
+	gb_ctx = dir_context(ln);
+	gb_ckb = 0;
+	gb_ckc = 0;
+	gb_row = row;
+	gb_lnok = 0;
+	return 0;
+}
+
+/* move the gap to the given character offset */
+static void gb_move(int off)
+{
+	while (gb_off < off && gb_end < gb_sz) {
+		int l = MIN(gb_sz - gb_end, uc_len(gb_buf + gb_end));
+		memmove(gb_buf + gb_beg, gb_buf + gb_end, l);
+		gb_beg += l;
+		gb_end += l;
+		gb_off++;
+	}
+	while (gb_off > off && gb_beg > 0) {
+		int l = 1;
+		while (l < gb_beg && (gb_buf[gb_beg - l] & 0xc0) == 0x80)
+			l++;
+		gb_beg -= l;
+		gb_end -= l;
+		memmove(gb_buf + gb_end, gb_buf + gb_beg, l);
+		gb_off--;
+	}
+	if (gb_ckb > gb_beg) {
+		gb_ckb = 0;
+		gb_ckc = 0;
+	}
+}
+
+/* replace del characters at off in the current line with ins */
+static int gb_edit(int off, int del, char *ins)
+{
+	int n = strlen(ins);
+	if (strchr(ins, '\n') || gb_load(xrow))
+		return 1;
+	gb_move(off);
+	for (; del > 0 && gb_end < gb_sz; del--, gb_n--)
+		gb_end = MIN(gb_sz, gb_end + uc_len(gb_buf + gb_end));
+	if (gb_end - gb_beg < n)
+		gb_grow(n);
+	memcpy(gb_buf + gb_beg, ins, n);
+	gb_beg += n;
+	gb_off += uc_slen(ins);
+	gb_n += uc_slen(ins);
+	gb_mod = 1;
+	gb_lnok = 0;
+	return 0;
+}
+
+/*
+ * Long lines (see led_print()) are not reordered and, while being
+ * edited, are drawn from the gap buffer without joining its parts;
+ * only the characters between the checkpoint and the end of the
+ * window are read.
+ */
+static int gb_long(int row)
+{
+	return row == gb_row && gb_n + 1 > xlim;
+}
+
+/* the column of byte b before the gap */
+static int gb_col(int b)
+{
+	char *s, *e = gb_buf + b;
+	int col;
+	if (gb_ckb > b) {
+		gb_ckb = 0;
+		gb_ckc = 0;
+	}
+	col = gb_ckc;
+	for (s = gb_buf + gb_ckb; s < e; s += uc_len(s))
+		col += ren_cwid(s, col);
+	return col;
+}
+
+/* the column of the cursor at the gap, as ren_cursor() computes it */
+static int gb_cursor(void)
+{
+	int b = gb_beg;
+	if (gb_end == gb_sz)	/* the cursor cannot be on the newline */
+		while (b > 0 && (gb_buf[--b] & 0xc0) == 0x80)
+			;
+	return gb_col(b);
+}
+
+/* draw the visible part of the line in the gap buffer */
+static void gb_draw(int row, char *syn)
+{
+	struct sbuf win = {0};
+	int cbeg = MAX(0, xleft - xcols);
+	int cend = xleft + xcols * 2;
+	char *s, *r;
+	int col, flg;
+	if (gb_ckc > cbeg) {
+		gb_ckb = 0;
+		gb_ckc = 0;
+	}
+	/* the first character ending after cbeg becomes the checkpoint */
+	s = gb_buf + gb_ckb;
+	col = gb_ckc;
+	while (s < gb_buf + gb_beg && col + ren_cwid(s, col) <= cbeg) {
+		col += ren_cwid(s, col);
+		s += uc_len(s);
+	}
+	gb_ckb = s - gb_buf;
+	gb_ckc = col;
+	flg = s > gb_buf ? RE_NOTBOL : 0;
+	for (r = s; r < gb_buf + gb_beg && col < cend; r += uc_len(r))
+		col += ren_cwid(r, col);
+	sbuf_mem(&win, s, r - s);
+	for (r = gb_buf + gb_end; r < gb_buf + gb_sz && col < cend; r += uc_len(r))
+		col += ren_cwid(r, col);
+	sbuf_mem(&win, gb_buf + gb_end, r - (gb_buf + gb_end));
+	if (r < gb_buf + gb_sz || col >= cend)
+		flg |= RE_NOTEOL;
+	else
+		sbuf_chr(&win, '\n');
+	led_printpart(sbuf_buf(&win), gb_ckc, gb_ctx, flg, row - xtop, xleft, xcols, syn, NULL);
+	sbuf_free(&win);
+}
+
+/* the contents of a line of xb, including pending insertions */
+static char *vi_get(int row)
+{
+	return row == gb_row ? gb_get() : lbuf_get(xb, row);
+}
+
 static void vi_wait(void)
 {
 	if (vi_printed > 1 || vi_printed < 0) {
@@ -83,7 +279,7 @@ static void vi_drawmsg(void)
 {
 	int td = xtd_set(+2);
 	syn_context('.', w_tmp ? 'Z' : 0);
-	led_print(vi_msg[0] ? vi_msg : "\n", xrows, 0, xcols, xhl ? "---" : "___", &vi_ledmod);
+	led_print(vi_msg[0] ? vi_msg : "\n", xrows, 0, xcols, xhl ? "---" : "___", NULL);
 	syn_context('.', 0);
 	vi_msg[0] = '\0';
 	xtd_set(td);
@@ -98,10 +294,12 @@ static void vi_drawquick(char *s, int row)
 
 static void vi_drawrow(int row)
 {
-	char *s = lbuf_get(xb, row);
-	syn_context(s ? '.' : ',', xhll && row == xrow ? '^' : 0);
-	led_print(s ? s : "~", row - xtop, xleft, xcols, xhl ? ex_filetype() : "",
-		vi_insert && row == xrow ? &vi_ledins : NULL);
+	char *s = gb_long(row) ? NULL : vi_get(row);
+	syn_context(s || gb_long(row) ? '.' : ',', xhll && row == xrow ? '^' : 0);
+	if (gb_long(row))
+		gb_draw(row, xhl ? ex_filetype() : "");
+	else
+		led_print(s ? s : "~", row - xtop, xleft, xcols, xhl ? ex_filetype() : "", NULL);
 	syn_context('.', 0);
 }
 
@@ -294,7 +492,6 @@ static char *vi_prompt(char *msg, int *kmap, char *hist)
 	term_pos(xrows, 0);
 	s = led_prompt(msg, "", kmap, xhl ? "-ex" : "___", xhist != 0 ? hist : NULL);
 	xtd_set(td);
-	led_reset(&vi_ledmod);
 	if (!s)
 		return NULL;
 	r = uc_dup(strlen(s) >= strlen(msg) ? s + strlen(msg) : s);
@@ -317,9 +514,9 @@ char *ex_read(char *msg)
 			term_chr('\n');
 		return s;
 	}
-	while ((c = getchar()) != EOF && c != '\n')
+	while ((c = term_read(0)) >= 0 && c != '\n')
 		sbuf_chr(&sb, c);
-	if (c == EOF) {
+	if (c < 0) {
 		sbuf_free(&sb);
 		return NULL;
 	}
@@ -344,11 +541,47 @@ void ex_show(char *msg, ...)
 	}
 }
 
+/* report the progress of a long operation on the status line */
+void ex_progress(char *msg, ...)
+{
+	char buf[256];
+	va_list ap;
+	if (!xvis)
+		return;
+	va_start(ap, msg);
+	vsnprintf(buf, sizeof(buf), msg, ap);
+	va_end(ap);
+	led_print(buf, xrows, 0, xcols, xhl ? "---" : "___", NULL);
+	term_commit();
+}
+
+/* show a message from the background; drawn only if waiting for a command */
+void ex_notify(char *msg, ...)
+{
+	char buf[256];
+	char *ln;
+	va_list ap;
+	if (!xvis)
+		return;
+	va_start(ap, msg);
+	vsnprintf(buf, sizeof(buf), msg, ap);
+	va_end(ap);
+	if (!vi_idle || vi_stale) {
+		if (!vi_msg[0])
+			snprintf(vi_msg, sizeof(vi_msg), "%s", buf);
+		return;
+	}
+	led_print(buf, xrows, 0, xcols, xhl ? "---" : "___", NULL);
+	ln = vi_get(xrow);
+	term_pos(xrow - xtop, vi_pos(ln, ren_cursor(ln, vi_off2col(xb, xrow, xoff))));
+	term_commit();
+}
+
 /* print an ex output line */
 void ex_print(char *line)
 {
 	if (vi_insert) {
-		led_print(line, xrows, 0, xcols, xhl ? "---" : "___", &vi_ledmod);
+		led_print(line, xrows, 0, xcols, xhl ? "---" : "___", NULL);
 	} else if (xvis) {
 		if (line && vi_printed == 0)
 			snprintf(vi_msg, sizeof(vi_msg), "%s", line);
@@ -365,6 +598,24 @@ void ex_print(char *line)
 	}
 }
 
+static long vi_msec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* whether to delay screen updates, because more input is pending */
+static int vi_busy(void)
+{
+	static long beg;	/* when screen updates were first delayed */
+	if (!vi_buflen && !term_pending())
+		return 0;
+	if (!vi_stale)
+		beg = vi_msec();
+	return vi_msec() - beg < 50;
+}
+
 static char *reg_getln(int h)
 {
 	return reg_get(0x80 | h, NULL);
@@ -427,13 +678,16 @@ static int vi_prefix(void)
 
 static int vi_col2off(struct lbuf *lb, int row, int col)
 {
-	char *ln = lbuf_get(lb, row);
+	char *ln = lb == xb ? vi_get(row) : lbuf_get(lb, row);
 	return ln ? ren_off(ln, col) : 0;
 }
 
 static int vi_off2col(struct lbuf *lb, int row, int off)
 {
-	char *ln = lbuf_get(lb, row);
+	char *ln;
+	if (lb == xb && gb_long(row) && off == gb_off)
+		return gb_col(gb_beg);
+	ln = lb == xb ? vi_get(row) : lbuf_get(lb, row);
 	return ln ? ren_pos(ln, off) : 0;
 }
 
@@ -944,7 +1198,7 @@ static char *vi_help(char *ln)
 			if ((r = strrchr(cmd, '"')) != NULL)
 				info = r + 1;
 	}
-	led_print(info, xrows, 0, xcols, xhl ? "---" : "___", &vi_ledmod);
+	led_print(info, xrows, 0, xcols, xhl ? "---" : "___", NULL);
 	term_pos(xrow - xtop, 0);
 	return NULL;
 }
@@ -982,48 +1236,46 @@ static int vi_change(int r1, int o1, int r2, int o2, int lnmode)
 	vi_drawfix(r1, r2 - r1 + 1, 1);
 	vi_insoff = xoff;
 	vi_insert = 1;
-	led_reset(&vi_ledins);
 	return VC_OK;
 }
 
 static int vi_case(int r1, int o1, int r2, int o2, int lnmode, int cmd)
 {
-	char *region = lbuf_region(xb, r1, lnmode ? 0 : o1, r2, lnmode ? -1 : o2);
-	char *s = region;
-	while (*s) {
-		int c = (unsigned char) s[0];
-		if (c <= 0x7f) {
-			if (cmd == 'u')
-				s[0] = tolower(c);
-			if (cmd == 'U')
-				s[0] = toupper(c);
-			if (cmd == '~')
-				s[0] = islower(c) ? toupper(c) : tolower(c);
+	int i;
+	for (i = r1; i <= r2; i++) {
+		char *ln = lbuf_get(xb, i);
+		char *s, *beg, *end;
+		if (!ln)
+			continue;
+		s = uc_dup(ln);
+		beg = !lnmode && i == r1 ? uc_chr(s, o1) : s;
+		end = !lnmode && i == r2 ? uc_chr(s, o2) : NULL;
+		beg = beg ? beg : s + strlen(s);
+		end = end ? end : s + strlen(s);
+		for (; beg < end; beg = uc_next(beg)) {
+			int c = (unsigned char) beg[0];
+			if (c <= 0x7f) {
+				if (cmd == 'u')
+					beg[0] = tolower(c);
+				if (cmd == 'U')
+					beg[0] = toupper(c);
+				if (cmd == '~')
+					beg[0] = islower(c) ? toupper(c) : tolower(c);
+			}
 		}
-		s = uc_next(s);
-	}
-	if (!lnmode) {
-		struct sbuf sb = {0};
-		char *s1 = lbuf_get(xb, r1);
-		char *s2 = lbuf_get(xb, r2);
-		sbuf_mem(&sb, s1, s1 ? uc_chr(s1, o1) - s1 : 0);
-		sbuf_str(&sb, region);
-		sbuf_str(&sb, s2 ? uc_chr(s2, o2) : "");
-		lbuf_edit(xb, sbuf_buf(&sb), r1, r2 + 1);
-		sbuf_free(&sb);
-	} else {
-		lbuf_edit(xb, region, r1, r2 + 1);
+		if (strcmp(s, ln))
+			lbuf_batch(xb, s, i);
+		free(s);
 	}
+	lbuf_batchdone(xb);
 	xrow = r2;
 	xoff = lnmode ? lbuf_indents(xb, r2) : o2;
-	free(region);
 	vi_drawfix(r1, r2 - r1 + 1, r2 - r1 + 1);
 	return VC_OK;
 }
 
 static int vi_pipe(int r1, int r2)
 {
-	char *text;
 	char *rep;
 	int kmap = 0;
 	char *cmd = vi_prompt("!", &kmap, reg_getln('!'));
@@ -1031,12 +1283,10 @@ static int vi_pipe(int r1, int r2)
 		return 0;
 	reg_put('!', cmd, 1);
 	reg_putln('!', cmd);
-	text = lbuf_cp(xb, r1, r2 + 1);
-	rep = cmd_pipe(cmd, text, 1);
+	rep = cmd_filter(cmd, xb, r1, r2 + 1);
 	if (rep)
 		lbuf_edit(xb, rep, r1, r2 + 1);
 	free(cmd);
-	free(text);
 	free(rep);
 	return VC_WIN;
 }
@@ -1056,9 +1306,10 @@ static int vi_shift(int r1, int r2, int dir)
 			ln = ln[0] == ' ' || ln[0] == '\t' ? ln + 1 : ln;
 		}
 		sbuf_str(&sb, ln);
-		lbuf_edit(xb, sbuf_buf(&sb), i, i + 1);
+		lbuf_batch(xb, sbuf_buf(&sb), i);
 		sbuf_free(&sb);
 	}
+	lbuf_batchdone(xb);
 	xrow = r1;
 	xoff = lbuf_indents(xb, xrow);
 	vi_drawfix(r1, r2 - r1 + 1, r2 - r1 + 1);
@@ -1150,19 +1401,25 @@ static int vc_insert(int cmd)
 		vi_drawrow(0);
 	vi_insoff = xoff;
 	vi_insert = 1;
-	led_reset(&vi_ledins);
 	return VC_OK;
 }
 
 static void vi_edit(int off, int del, char *ins)
 {
-	char *ln = lbuf_get(xb, xrow);
 	struct sbuf sb = {0};
-	char *pos = ln ? uc_chr(ln, off) : NULL;
-	char *end = pos ? uc_chr(pos, del) : NULL;
-	char *last = strrchr(ins, '\n');
+	char *ln, *pos, *end, *last;
 	int lncnt = linecount(ins);
 	int row = xrow;
+	if (!gb_edit(off, del, ins)) {
+		xoff = xoff - del + uc_slen(ins);
+		vi_drawrow(row);
+		return;
+	}
+	gb_commit();
+	ln = lbuf_get(xb, xrow);
+	pos = ln ? uc_chr(ln, off) : NULL;
+	end = pos ? uc_chr(pos, del) : NULL;
+	last = strrchr(ins, '\n');
 	last = last ? last + 1 : ins;
 	sbuf_mem(&sb, ln, pos ? pos - ln : 0);
 	sbuf_str(&sb, ins);
@@ -1172,8 +1429,6 @@ static void vi_edit(int off, int del, char *ins)
 	xrow += lncnt - 1;
 	xoff = xoff - del + uc_slen(last) - (lncnt > 1 ? off : 0);
 	vi_insoff = lncnt > 1 ? 0 : vi_insoff;
-	if (lncnt > 1)
-		led_reset(&vi_ledins);
 	if (lncnt > 1)
 		vi_drawfix(row + 1, 0, lncnt - 1);
 	sbuf_free(&sb);
@@ -1196,6 +1451,7 @@ static int vi_lastword(char *s, int off)
 
 static int vc_insertcmd(void)
 {
+	int buffered = vi_buflen;
 	int c = vi_read();
 	char *s = NULL;
 	int off;
@@ -1216,7 +1472,7 @@ static int vc_insertcmd(void)
 			vi_edit(vi_insoff, xoff - vi_insoff, "");
 		return VC_OK;
 	case TK_CTL('w'):
-		s = lbuf_get(xb, xrow);
+		s = vi_get(xrow);
 		off = vi_lastword(s, xoff);
 		off = MAX(off, vi_insoff);
 		if (off < xoff)
@@ -1227,7 +1483,7 @@ static int vc_insertcmd(void)
 		vi_insoff = vi_insoff > 0 ? vi_insoff + 1 : 0;
 		return VC_OK;
 	case TK_CTL('d'):
-		s = lbuf_get(xb, xrow);
+		s = vi_get(xrow);
 		if (s[0] == ' ' || s[0] == '\t') {
 			vi_edit(0, 1, "");
 			vi_insoff = vi_insoff > 0 ? vi_insoff - 1 : 0;
@@ -1236,8 +1492,10 @@ static int vc_insertcmd(void)
 	case TK_CTL('a'):
 		if (1) {
 			char cmp[128];
-			char *ln = uc_sub(lbuf_get(xb, xrow), 0, xoff);
-			char *ac = vi_help(ln);
+			char *ln, *ac;
+			gb_commit();
+			ln = uc_sub(vi_get(xrow), 0, xoff);
+			ac = vi_help(ln);
 			if (ac != NULL)
 				snprintf(cmp, sizeof(cmp), "%s", ac);
 			free(ln);
@@ -1245,7 +1503,7 @@ static int vc_insertcmd(void)
 		return VC_OK;
 	case '\n':
 		if (xai) {
-			char *ln = lbuf_get(xb, xrow);
+			char *ln = vi_get(xrow);
 			char in[LEN(vi_ai) + 1];
 			int sz = MIN(LEN(in) - 2, xoff);
 			int indents = vi_indents(ln, in, sz);
@@ -1258,10 +1516,17 @@ static int vc_insertcmd(void)
 		}
 		return VC_OK;
 	default:
+		if (c == TK_ESC && !buffered && (s = term_paste()) != NULL) {
+			vi_edit(xoff, 0, s);
+			free(s);
+			return VC_OK;
+		}
 		if (c == TK_ESC)
 			vi_readiseq();
 		if (TK_INT(c)) {
-			char *ln = lbuf_get(xb, xrow);
+			char *ln;
+			gb_commit();
+			ln = lbuf_get(xb, xrow);
 			if (xai && ln[lbuf_indents(xb, xrow)] == '\n') {
 				lbuf_edit(xb, "\n", xrow, xrow + 1);
 				xoff = 0;
@@ -1277,48 +1542,77 @@ static int vc_insertcmd(void)
 	return VC_OK;
 }
 
+/* concatenate pre, cnt copies of s, and post */
+static char *vi_repeat(char *pre, char *s, int cnt, char *post)
+{
+	long prelen = strlen(pre), len = strlen(s), postlen = strlen(post);
+	char *r = malloc(prelen + len * cnt + postlen + 1);
+	char *d = r;
+	int i;
+	memcpy(d, pre, prelen);
+	d += prelen;
+	for (i = 0; i < cnt; i++, d += len)
+		memcpy(d, s, len);
+	memcpy(d, post, postlen + 1);
+	return r;
+}
+
+/* put cnt copies of buf inside the current line; returns the number of new lines */
+static int vi_putchars(char *buf, int cnt, int cmd)
+{
+	char *ln = xrow < lbuf_len(xb) ? lbuf_get(xb, xrow) : "\n";
+	int off = ren_noeol(ln, xoff) + (ln[0] != '\n' && cmd == 'p');
+	char *pre = uc_sub(ln, 0, off);
+	char *post = uc_sub(ln, off, -1);
+	char *s = vi_repeat(pre, buf, cnt, post);
+	int lncnt;
+	lbuf_edit(xb, s, xrow, xrow + 1);
+	lncnt = linecount(s) - 1;
+	xoff = off + uc_slen(buf) * cnt - 1;
+	free(pre);
+	free(post);
+	free(s);
+	return lncnt;
+}
+
 static int vc_put(int cmd)
 {
 	int cnt = MAX(1, vi_arg1);
 	int lnmode;
 	char *buf = reg_get(vi_ybuf, &lnmode);
 	int lncnt = 0;
-	int i;
 	if (!buf)
 		snprintf(vi_msg, sizeof(vi_msg), "yank buffer empty");
 	if (!buf || !buf[0])
 		return 0;
 	if (lnmode) {
-		struct sbuf sb = {0};
-		for (i = 0; i < cnt; i++)
-			sbuf_str(&sb, buf);
+		char *s = vi_repeat("", buf, cnt, "");
 		if (cmd == 'p' && lbuf_len(xb))
 			xrow++;
-		lbuf_edit(xb, sbuf_buf(&sb), xrow, xrow);
-		lncnt = linecount(sbuf_buf(&sb));
+		lbuf_edit(xb, s, xrow, xrow);
+		lncnt = linecount(s);
 		xoff = lbuf_indents(xb, xrow);
-		sbuf_free(&sb);
-	} else {
-		struct sbuf sb = {0};
-		char *ln = xrow < lbuf_len(xb) ? lbuf_get(xb, xrow) : "\n";
-		int off = ren_noeol(ln, xoff) + (ln[0] != '\n' && cmd == 'p');
-		char *s = uc_sub(ln, 0, off);
-		sbuf_str(&sb, s);
-		free(s);
-		for (i = 0; i < cnt; i++)
-			sbuf_str(&sb, buf);
-		s = uc_sub(ln, off, -1);
-		sbuf_str(&sb, s);
 		free(s);
-		lbuf_edit(xb, sbuf_buf(&sb), xrow, xrow + 1);
-		lncnt = linecount(sbuf_buf(&sb)) - 1;
-		xoff = off + uc_slen(buf) * cnt - 1;
-		sbuf_free(&sb);
+	} else {
+		lncnt = vi_putchars(buf, cnt, cmd);
 	}
 	vi_drawfix(xrow, 1, lncnt);
 	return VC_OK;
 }
 
+/* a bracketed paste outside insert mode is put before the cursor */
+static int vc_paste(void)
+{
+	char *s = vi_buflen ? NULL : term_paste();
+	int lncnt;
+	if (!s)
+		return 0;
+	lncnt = s[0] ? vi_putchars(s, 1, 'P') : 0;
+	free(s);
+	vi_drawfix(xrow, 1, lncnt);
+	return VC_OK;
+}
+
 static int join_spaces(char *prev, char *next)
 {
 	int prevlen = strlen(prev);
@@ -1382,13 +1676,16 @@ static int vc_status(void)
 {
 	int col = vi_off2col(xb, xrow, xoff);
 	int c = vi_insert ? 'I' : 'N';
+	char *job = cmd_jobstate();
 	snprintf(vi_msg, sizeof(vi_msg),
-		"%c%04d %c %s  %s %d C%d",
+		"%c%04d %c %s  %s %d C%d%s%s",
 		w_tmp ? '_' : c, xrow + 1,
-		lbuf_modified(xb) ? 'M' : '-',
+		lbuf_modified(xb) || gb_mod ? 'M' : '-',
 		ex_path()[0] ? ex_path() : "unnamed",
 		kmap_map(xkmap, 0),
-		lbuf_len(xb), ren_cursor(lbuf_get(xb, xrow), col) + 1);
+		lbuf_len(xb), (gb_long(xrow) && xoff == gb_off ?
+			gb_cursor() : ren_cursor(vi_get(xrow), col)) + 1,
+		job ? "  " : "", job ? job : "");
 	return 0;
 }
 
@@ -1696,7 +1993,6 @@ static int vc_quick(int newwin)
 	} else if (c >= '1' && c <= '9') {
 		sel = c - '1';
 	}
-	led_reset(&vi_ledmod);
 	cmd[0] = '\0';
 	if (sel >= 0 && sel < tlist_cnt(tls))
 		snprintf(cmd, sizeof(cmd), "%s", tlist_get(tls, sel));
@@ -1762,16 +2058,20 @@ static void vi(void)
 	while (!xquit) {
 		int mod = 0;
 		int nrow = xrow;
-		int noff = ren_noeol(lbuf_get(xb, xrow), xoff);
+		int noff = vi_insert ? xoff : ren_noeol(vi_get(xrow), xoff);
 		int otop = xtop;
 		int oleft = xleft;
 		int orow = xrow;
 		char *opath = ex_path();	/* do not dereference; to detect buffer changes */
 		int mv = 0, n, ru;
+		int key = 0;		/* command key for latency tracing */
+		lat_wait();
 		if (!vi_insert) {
 			term_cmd(&n);
 			vi_arg2 = 0;
+			vi_idle = 1;
 			vi_ybuf = vi_yankbuf();
+			vi_idle = 0;
 			vi_arg1 = vi_prefix();
 			if (!vi_ybuf)
 				vi_ybuf = vi_yankbuf();
@@ -1784,6 +2084,7 @@ static void vi(void)
 			if (!vi_insert)
 				glob_id['*'] = ex_id();
 		} else if (mv > 0) {
+			key = mv;
 			if (strchr("\'`GHML/?{}[]nN", mv) || (mv == '%' && noff < 0))
 				vi_marksave();
 			xrow = nrow;
@@ -1797,12 +2098,14 @@ static void vi(void)
 			if (mv == '|')
 				xcol = vi_pcol;
 		} else if (mv < 0) {
+			key = -1;
 			mod = VC_BAD;
 		} else {
 			int c = vi_read();
 			int k = 0;
 			if (c <= 0)
 				continue;
+			key = c;
 			lbuf_mark(xb, '^', xrow, xoff);
 			switch (c) {
 			case TK_CTL('b'):
@@ -2079,6 +2382,8 @@ static void vi(void)
 				vc_execute();
 				break;
 			case TK_ESC:
+				if ((mod = vc_paste()))
+					break;
 				vi_readiseq();
 				continue;
 			default:
@@ -2092,6 +2397,7 @@ static void vi(void)
 					glob_id['*'] = ex_id();
 			}
 		}
+		lat_cmd(key);
 		if (mod & VC_BAD)
 			vc_repeatstop();
 		if (mod & VC_OK)
@@ -2114,21 +2420,20 @@ static void vi(void)
 			vi_switch(1 - id);
 			vi_wfix();
 			strcpy(msg, vi_msg);
-			led_reset(&vi_ledmod);
 			if (ru)
 				vc_status();
-			led_reset(&vi_ledmod);
 			vi_drawagain(vi_off2col(xb, xrow, xoff), -1);
 			strcpy(vi_msg, msg);
 			w_tmp = 0;
 			vi_switch(id);
 		}
-		if (mod & VC_WIN)
-			led_reset(&vi_ledmod);
 		if (ru && !vi_msg[0])
 			vc_status();
-		if (mod & (VC_ROW | VC_WIN) || xleft != oleft) {
-			int lineonly = mod & VC_ROW && xleft == oleft && xtop == otop;
+		if (vi_busy()) {
+			vi_stale = 1;
+		} else if (vi_stale || mod & (VC_ROW | VC_WIN) || xleft != oleft) {
+			int lineonly = !vi_stale && mod & VC_ROW && xleft == oleft && xtop == otop;
+			vi_stale = 0;
 			vi_drawagain(xcol, lineonly ? xrow : -1);
 			if (lineonly && xrow != orow)
 				vi_drawagain(xcol, orow);
@@ -2142,21 +2447,28 @@ static void vi(void)
 			if (vi_msg[0])
 				vi_drawmsg();
 		}
-		ln = lbuf_get(xb, xrow);
-		if (vi_insert)
-			term_pos(xrow - xtop, vi_pos(ln, ren_insert(ln, xoff)));
-		else
-			term_pos(xrow - xtop, vi_pos(ln, ren_cursor(ln, xcol)));
-		term_commit();
+		if (!vi_stale) {
+			if (vi_insert && gb_long(xrow) && xoff == gb_off) {
+				int col = gb_col(gb_beg);
+				term_pos(xrow - xtop, gb_ctx >= 0 ? col - xleft : xleft + xcols - col - 1);
+			} else {
+				ln = vi_get(xrow);
+				if (vi_insert)
+					term_pos(xrow - xtop, vi_pos(ln, ren_insert(ln, xoff)));
+				else
+					term_pos(xrow - xtop, vi_pos(ln, ren_cursor(ln, xcol)));
+			}
+			term_commit();
+		}
 		if (!vi_insert)
 			lbuf_tx(xb);
 	}
-	led_reset(&vi_ledmod);
-	led_reset(&vi_ledins);
 }
 
 int main(int argc, char *argv[])
 {
+	char *batch = NULL;
+	int ret = 0;
 	int i;
 	char *prog = strchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
 	xvis = strcmp("ex", prog) && strcmp("neatex", prog);
@@ -2172,12 +2484,38 @@ int main(int argc, char *argv[])
 			case 'v':
 				xvis = 1;
 				continue;
+			case 'r':
+			case 'p':
+				if (i + 1 >= argc)
+					break;
+				if ((argv[i][1] == 'r' ? term_record : term_replay)(argv[i + 1])) {
+					fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[i + 1]);
+					return 1;
+				}
+				i++;
+				continue;
+			case 'd':
+				if (i + 1 >= argc)
+					break;
+				term_headless(argv[++i]);
+				continue;
+			case 'b':
+				if (i + 1 >= argc)
+					break;
+				batch = argv[++i];
+				xvis = 0;
+				xled = 0;
+				continue;
 			case 'h':
 				printf("usage: %s [options] [file...]\n\n", argv[0]);
 				printf("options:\n");
 				printf("  -v    start in vi mode\n");
 				printf("  -e    start in ex mode\n");
 				printf("  -s    silent mode (for ex mode only)\n");
+				printf("  -r f  record terminal input in f\n");
+				printf("  -p f  replay terminal input from f (headless)\n");
+				printf("  -d f  use an in-memory terminal and save its screen in f\n");
+				printf("  -b f  execute ex script f on each file in parallel (batch mode)\n");
 				return 0;
 			}
 		}
@@ -2190,7 +2528,9 @@ int main(int argc, char *argv[])
 	if (xled || xvis)
 		term_init();
 	signal(SIGPIPE, SIG_IGN);
-	if (!ex_init(argv + i)) {
+	if (batch) {
+		ret = ex_batch(batch, argv + i);
+	} else if (!ex_init(argv + i)) {
 		if (xvis)
 			vi();
 		else
@@ -2199,10 +2539,12 @@ int main(int argc, char *argv[])
 	}
 	if (xled || xvis)
 		term_done();
+	term_finish();
+	lat_done();
 	free(w_path);
 	reg_done();
 	syn_done();
 	dir_done();
 	tag_done();
-	return 0;
+	return ret;
 }
@@ -12,6 +12,8 @@ int lbuf_rd(struct lbuf *lbuf, int fd, int beg, int end);
 int lbuf_wr(struct lbuf *lbuf, int fd, int beg, int end);
 void lbuf_edit(struct lbuf *lbuf, char *s, int beg, int end);
 void lbuf_tx(struct lbuf *lbuf);
+void lbuf_batch(struct lbuf *lb, char *s, int pos);
+void lbuf_batchdone(struct lbuf *lb);
 char *lbuf_cp(struct lbuf *lbuf, int beg, int end);
 char *lbuf_get(struct lbuf *lbuf, int pos);
 int lbuf_len(struct lbuf *lbuf);
@@ -21,6 +23,7 @@ int lbuf_undo(struct lbuf *lbuf);
 int lbuf_redo(struct lbuf *lbuf);
 int lbuf_modified(struct lbuf *lb);
 void lbuf_saved(struct lbuf *lb, int clear);
+long lbuf_size(struct lbuf *lb);
 int lbuf_indents(struct lbuf *lb, int r);
 int lbuf_eol(struct lbuf *lb, int r);
 void lbuf_globset(struct lbuf *lb, int pos, int dep);
@@ -55,6 +58,7 @@ void sbuf_cut(struct sbuf *s, long len);
 #define RE_ICASE		1
 #define RE_NOTBOL		2
 #define RE_NOTEOL		4
+#define RE_STARTEND		8
 /* regular expression sets: searching for multiple regular expressions */
 struct rset *rset_make(int n, char **pat, int flg);
 int rset_find(struct rset *re, char *s, int n, int *grps, int flg);
@@ -76,8 +80,9 @@ int ren_noeol(char *s, int p);
 int ren_off(char *s, int pos);
 int ren_wid(char *s);
 int ren_region(char *s, int c1, int c2, int *l1, int *l2, int closed);
-char *ren_translate(char *s, char *ln);
+char *ren_translate(char *s, int shape);
 int ren_cwid(char *s, int pos);
+char *ren_span(char *s, int col, int *pos, int *ctx);
 
 /* text direction */
 int dir_context(char *s);
@@ -88,6 +93,7 @@ void dir_done(void);
 /* string registers */
 char *reg_get(int c, int *lnmode);
 void reg_put(int c, char *s, int lnmode);
+void reg_append(int c, char *s);
 void reg_done(void);
 
 /* utf-8 helper functions */
@@ -112,7 +118,8 @@ char **uc_chop(char *s, int *n);
 char *uc_next(char *s);
 char *uc_prev(char *beg, char *s);
 char *uc_beg(char *beg, char *s);
-char *uc_shape(char *beg, char *s);
+int *uc_shape(char **chrs, int n);
+void uc_cput(char *d, int c);
 char *uc_lastline(char *s);
 int uc_word(char *ln, char *dst, int len, int off, char *ext);
 
@@ -134,7 +141,16 @@ int term_rows(void);
 int term_cols(void);
 int term_rowx(void);
 int term_read(int buffered);
+char *term_paste(void);
+int term_pending(void);
+void term_headless(char *dump);
+int term_record(char *path);
+int term_replay(char *path);
+void term_finish(void);
 void term_commit(void);
+void term_flush(void);
+int term_grid(int row);
+void term_cell(int col, char *s, int wid, int att);
 char *term_seqattr(int att, int old);
 char *term_seqkill(void);
 void term_push(char *s, int n);
@@ -145,9 +161,66 @@ char *term_cmd(int *n);
 #define TK_INT(c)	((c) < 0 || (c) == TK_ESC || (c) == TK_CTL('c'))
 #define TK_ESC		(TK_CTL('['))
 
+/* latency tracing */
+void lat_input(void);
+void lat_key(int buffered);
+void lat_wait(void);
+void lat_cmd(int cmd);
+void lat_paint(void);
+void lat_show(void);
+void lat_done(void);
+
+/* profiling counters; compiled in with -DPROF */
+#define PROF_REGEX	0
+#define PROF_RSET	1
+#define PROF_SYN	2
+#define PROF_REN	3
+#define PROF_DIR	4
+#define PROF_LED	5
+#define PROF_LBUF	6
+#define PROF_CMD	7
+#define PROF_LSP	8
+#define PROF_TERM	9
+#define PROF_CNT	10
+void prof_beg(int id);
+void prof_end(int id, long bytes);
+void prof_show(void);
+void prof_pause(int on);
+#ifdef PROF
+#define PROF_BEG(id)		prof_beg(id)
+#define PROF_END(id, bytes)	prof_end(id, bytes)
+#else
+#define PROF_BEG(id)
+#define PROF_END(id, bytes)
+#endif
+
+/* in-memory terminal */
+void vt_init(int rows, int cols);
+void vt_write(char *s, long n);
+int vt_save(char *path);
+void vt_done(void);
+
+/* parallel loops */
+void par_for(int n, int chunk, void (*fn)(void *dat, int beg, int end), void *dat);
+
+/* reading argument list files in the background */
+#define PRECNT		8	/* the number of files read ahead */
+void pre_fetch(char **paths, int n);
+struct lbuf *pre_take(char *path);
+void pre_done(void);
+
+/* event loop */
+struct pollfd;
+int ev_add(int fd, int events, void (*cb)(int fd, int revents, void *dat), void *dat);
+void ev_del(int fd);
+int ev_timer(int msec, void (*cb)(void *dat), void *dat);
+void ev_untimer(int id);
+int ev_poll(struct pollfd *fds, int n, int timeout);
+
 /* line-oriented input and output */
 char *led_prompt(char *pref, char *post, int *kmap, char *syn, char *hist);
 void led_print(char *s0, int row, int cbeg, int cols, char *syn, char **old);
+void led_printpart(char *s, int cpos, int ctx, int flg, int row, int cbeg, int cols, char *syn, char **old);
 void led_reset(char **old);
 
 /* ex commands */
@@ -156,7 +229,10 @@ int ex_command(char *cmd);
 char *ex_read(char *msg);
 void ex_print(char *line);
 void ex_show(char *msg, ...);
+void ex_progress(char *msg, ...);
+void ex_notify(char *msg, ...);
 int ex_init(char **files);
+int ex_batch(char *path, char **files);
 void ex_done(void);
 char *ex_path(void);
 char *ex_filetype(void);
@@ -171,8 +247,12 @@ int ex_id(void);
 
 /* process management */
 char *cmd_pipe(char *cmd, char *ibuf, int oproc);
+char *cmd_filter(char *cmd, struct lbuf *lb, int beg, int end);
 char *cmd_unix(char *path, char *ibuf);
 int cmd_exec(char *cmd);
+int cmd_job(char *cmd);
+char *cmd_jobstate(void);
+void cmd_jobkill(void);
 
 /* syntax highlighting */
 #define SYN_BD		0x010000
@@ -190,7 +270,7 @@ int cmd_exec(char *cmd);
 #define SYN_BG(a)	(((a) >> 8) & 0xff)
 #define SYN_RANK(c)	(((c) & SYN_HP) - ((c) & SYN_LP))
 
-int *syn_highlight(char *ft, char *s);
+int *syn_highlight(char *ft, char *s, int flg);
 char *syn_filetype(char *path);
 void syn_context(int fg, int bg);
 int syn_merge(int old, int new);
@@ -237,7 +317,9 @@ extern int xlim;
 extern int xru;
 extern int xhist;
 extern int xvte;
+extern int xsync;
 extern int xts;
+extern int xbufmem;
 
 /* tag file handling */
 int tag_init(void);
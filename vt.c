@@ -0,0 +1,236 @@
+/* an in-memory virtual terminal, interpreting the output of term.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vi.h"
+
+static char (*vt_scr)[16];	/* screen cells; empty for the second column of wide characters */
+static int vt_rows, vt_cols;	/* screen dimensions */
+static int vt_r, vt_c;		/* cursor position */
+static int vt_wrap;		/* a character was written in the last column */
+static int vt_top, vt_bot;	/* scrolling region */
+static char vt_seq[64];		/* incomplete escape sequence or character */
+static int vt_seqlen;
+
+static void vt_clear(int r, int beg, int end)
+{
+	int i;
+	for (i = beg; i < end; i++)
+		strcpy(vt_scr[r * vt_cols + i], " ");
+}
+
+/* move rows [beg, end) by n rows (down if positive) and clear the rest */
+static void vt_shift(int beg, int end, int n)
+{
+	int i;
+	if (beg >= end)
+		return;
+	n = MAX(beg - end, MIN(end - beg, n));
+	if (n > 0)
+		memmove(vt_scr[(beg + n) * vt_cols], vt_scr[beg * vt_cols],
+			(end - beg - n) * vt_cols * sizeof(vt_scr[0]));
+	if (n < 0)
+		memmove(vt_scr[beg * vt_cols], vt_scr[(beg - n) * vt_cols],
+			(end - beg + n) * vt_cols * sizeof(vt_scr[0]));
+	for (i = n > 0 ? beg : end + n; i < (n > 0 ? beg + n : end); i++)
+		vt_clear(i, 0, vt_cols);
+}
+
+static void vt_lf(void)
+{
+	vt_c = 0;
+	vt_wrap = 0;
+	if (vt_r == vt_bot)
+		vt_shift(vt_top, vt_bot + 1, -1);
+	else if (vt_r < vt_rows - 1)
+		vt_r++;
+}
+
+static void vt_move(int r, int c)
+{
+	vt_r = MAX(0, MIN(vt_rows - 1, r));
+	vt_c = MAX(0, MIN(vt_cols - 1, c));
+	vt_wrap = 0;
+}
+
+static void vt_chr(char *s, int len)
+{
+	int wid = uc_wid(s);
+	int i;
+	if (wid == 0 && vt_c + vt_wrap > 0) {
+		int p = vt_c + vt_wrap - 1;
+		char *prev;
+		while (p > 0 && !vt_scr[vt_r * vt_cols + p][0])
+			p--;
+		prev = vt_scr[vt_r * vt_cols + p];
+		if (strlen(prev) + len < sizeof(vt_scr[0]))
+			strncat(prev, s, len);
+		return;
+	}
+	if (vt_wrap || vt_c + wid > vt_cols)
+		vt_lf();
+	memcpy(vt_scr[vt_r * vt_cols + vt_c], s, len);
+	vt_scr[vt_r * vt_cols + vt_c][len] = '\0';
+	for (i = 1; i < wid && vt_c + i < vt_cols; i++)
+		vt_scr[vt_r * vt_cols + vt_c + i][0] = '\0';
+	if (vt_c + wid >= vt_cols) {
+		vt_c = vt_cols - 1;
+		vt_wrap = 1;
+	} else {
+		vt_c += wid;
+	}
+}
+
+static void vt_csi(char *s, int len)
+{
+	int par[16] = {0};
+	int n = 0;
+	int cmd = (unsigned char) s[len - 1];
+	int p1, i;
+	if (s[2] == '?')		/* private modes are ignored */
+		return;
+	for (i = 2; i < len - 1 && n < LEN(par); i++) {
+		if (s[i] == ';')
+			n++;
+		else if (s[i] >= '0' && s[i] <= '9')
+			par[n] = par[n] * 10 + s[i] - '0';
+	}
+	p1 = par[0] ? par[0] : 1;
+	switch (cmd) {
+	case 'H':
+	case 'f':
+		vt_move(p1 - 1, (par[1] ? par[1] : 1) - 1);
+		break;
+	case 'G':
+		vt_move(vt_r, p1 - 1);
+		break;
+	case 'A':
+		vt_move(vt_r - p1, vt_c);
+		break;
+	case 'B':
+		vt_move(vt_r + p1, vt_c);
+		break;
+	case 'C':
+		vt_move(vt_r, vt_c + p1);
+		break;
+	case 'D':
+		vt_move(vt_r, vt_c - p1);
+		break;
+	case 'K':
+		if (par[0] == 0)
+			vt_clear(vt_r, vt_c, vt_cols);
+		if (par[0] == 1)
+			vt_clear(vt_r, 0, vt_c + 1);
+		if (par[0] == 2)
+			vt_clear(vt_r, 0, vt_cols);
+		break;
+	case 'J':
+		if (par[0] == 0)
+			vt_clear(vt_r, vt_c, vt_cols);
+		for (i = par[0] ? 0 : vt_r + 1; i < vt_rows; i++)
+			vt_clear(i, 0, vt_cols);
+		break;
+	case 'r':
+		vt_top = MIN(vt_rows - 1, p1 - 1);
+		vt_bot = par[1] ? MIN(vt_rows - 1, par[1] - 1) : vt_rows - 1;
+		if (vt_bot <= vt_top) {
+			vt_top = 0;
+			vt_bot = vt_rows - 1;
+		}
+		vt_move(0, 0);
+		break;
+	case 'L':
+		if (vt_r >= vt_top && vt_r <= vt_bot)
+			vt_shift(vt_r, vt_bot + 1, p1);
+		vt_move(vt_r, 0);
+		break;
+	case 'M':
+		if (vt_r >= vt_top && vt_r <= vt_bot)
+			vt_shift(vt_r, vt_bot + 1, -p1);
+		vt_move(vt_r, 0);
+		break;
+	}
+}
+
+/* apply a complete character or escape sequence */
+static void vt_apply(char *s, int len)
+{
+	if (s[0] == '\33') {
+		if (s[1] == '[')
+			vt_csi(s, len);
+	} else if (s[0] == '\n') {
+		vt_lf();
+	} else if (s[0] == '\r') {
+		vt_move(vt_r, 0);
+	} else if (s[0] == '\b') {
+		vt_move(vt_r, vt_c - 1);
+	} else if (s[0] == '\t') {
+		vt_move(vt_r, (vt_c & ~7) + 8);
+	} else if ((unsigned char) s[0] >= 0x20 && s[0] != 0x7f) {
+		vt_chr(s, len);
+	}
+}
+
+static int vt_complete(char *s, int len)
+{
+	if (s[0] == '\33')
+		return len > 1 && (s[1] != '[' || (len > 2 && s[len - 1] >= 0x40 && s[len - 1] <= 0x7e));
+	return len >= uc_len_expect(s[0]);
+}
+
+void vt_write(char *s, long n)
+{
+	long i;
+	for (i = 0; i < n; i++) {
+		vt_seq[vt_seqlen++] = s[i];
+		vt_seq[vt_seqlen] = '\0';
+		if (vt_complete(vt_seq, vt_seqlen) || vt_seqlen >= sizeof(vt_seq) - 1) {
+			vt_apply(vt_seq, vt_seqlen);
+			vt_seqlen = 0;
+		}
+	}
+}
+
+/* set terminal dimensions; the contents are kept if unchanged */
+void vt_init(int rows, int cols)
+{
+	int i;
+	if (vt_scr && rows == vt_rows && cols == vt_cols)
+		return;
+	free(vt_scr);
+	vt_rows = rows;
+	vt_cols = cols;
+	vt_scr = malloc(rows * cols * sizeof(vt_scr[0]));
+	for (i = 0; i < rows; i++)
+		vt_clear(i, 0, cols);
+	vt_top = 0;
+	vt_bot = rows - 1;
+	vt_move(0, 0);
+}
+
+/* write screen contents to the given file, without trailing blanks */
+int vt_save(char *path)
+{
+	struct sbuf sb = {0};
+	FILE *fp;
+	int r, c;
+	if (!vt_scr || !(fp = fopen(path, "w")))
+		return 1;
+	for (r = 0; r < vt_rows; r++) {
+		sbuf_cut(&sb, 0);
+		for (c = 0; c < vt_cols; c++)
+			sbuf_str(&sb, vt_scr[r * vt_cols + c]);
+		while (sbuf_len(&sb) && sbuf_buf(&sb)[sbuf_len(&sb) - 1] == ' ')
+			sbuf_cut(&sb, sbuf_len(&sb) - 1);
+		fprintf(fp, "%s\n", sbuf_buf(&sb));
+	}
+	sbuf_free(&sb);
+	fclose(fp);
+	return 0;
+}
+
+void vt_done(void)
+{
+	free(vt_scr);
+	vt_scr = NULL;
+}